@@ -3,6 +3,9 @@
 
 #include "app.h"
 #include "module.h"
+#include "es_recorder.h"
+#include "es_replay.h"
+#include "stream_worker.h"
 #include "host_manager.h"
 #include "util/listeners_list.h"
 
@@ -26,6 +29,10 @@ static void session_disconnected_main(app_t *app, void *context);
 
 static void destroy_session_main(app_t *app, void *context);
 
+static void replay_finished(void *context);
+
+static void replay_finished_main(app_t *app, void *context);
+
 typedef enum stream_manager_state_t {
     STREAM_MANAGER_STATE_IDLE,
     STREAM_MANAGER_STATE_REQUESTING,
@@ -38,6 +45,15 @@ struct stream_manager_t {
     app_t *app;
     host_manager_t *host_manager;
     array_list_t *listeners;
+    stream_worker_t *audio_worker, *video_worker;
+    /* What sessions feed, the workers or the module itself, wrapped by the recorder if there is one */
+    const IHS_StreamAudioCallbacks *audio_callbacks;
+    void *audio_context;
+    const IHS_StreamVideoCallbacks *video_callbacks;
+    void *video_context;
+    es_recorder_t *recorder;
+    es_replay_t *replay;
+    bool suspended;
     union {
         stream_manager_state_t code;
         struct {
@@ -73,7 +89,46 @@ stream_manager_t *stream_manager_create(app_t *app, host_manager_t *host_manager
     manager->app = app;
     manager->host_manager = host_manager;
     manager->listeners = listeners_list_create();
+    // Decoding runs on worker threads, so ihslib's receive thread only has to copy packets
+    if (getenv("IHSPLAY_DIRECT_SUBMIT") == NULL) {
+        const char *jitter_target = getenv("IHSPLAY_JITTER_TARGET_MS");
+        manager->audio_worker = stream_worker_create_audio(module_audio_callbacks(), NULL, module_audio_arrival);
+        manager->video_worker = stream_worker_create_video(module_video_callbacks(), NULL,
+                                                           jitter_target != NULL ? atoi(jitter_target) : 0,
+                                                           module_video_arrival);
+        manager->audio_callbacks = stream_worker_audio_callbacks();
+        manager->audio_context = manager->audio_worker;
+        manager->video_callbacks = stream_worker_video_callbacks();
+        manager->video_context = manager->video_worker;
+    } else {
+        manager->audio_callbacks = module_audio_callbacks();
+        manager->video_callbacks = module_video_callbacks();
+    }
+    const char *record_path = getenv("IHSPLAY_RECORD_ES");
+    if (record_path != NULL) {
+        manager->recorder = es_recorder_create(record_path, manager->video_callbacks, manager->video_context,
+                                               manager->audio_callbacks, manager->audio_context);
+    }
+    if (manager->recorder != NULL) {
+        manager->audio_callbacks = es_recorder_audio_callbacks();
+        manager->audio_context = manager->recorder;
+        manager->video_callbacks = es_recorder_video_callbacks();
+        manager->video_context = manager->recorder;
+    }
     host_manager_register_listener(host_manager, &host_manager_listener, manager);
+    // Play back a recording instead of streaming from a host, for benchmarks. The app quits once it's done
+    const char *replay_path = getenv("IHSPLAY_REPLAY_ES");
+    if (replay_path != NULL) {
+        const char *speed = getenv("IHSPLAY_REPLAY_SPEED");
+        // A recording can't answer key frame requests, frames have to wait for the decoder instead of being dropped
+        if (manager->audio_worker != NULL) {
+            stream_worker_set_blocking(manager->audio_worker, true);
+            stream_worker_set_blocking(manager->video_worker, true);
+        }
+        manager->replay = es_replay_start(replay_path, speed != NULL ? atof(speed) : 1.0, manager->video_callbacks,
+                                          manager->video_context, manager->audio_callbacks,
+                                          manager->audio_context, replay_finished, manager);
+    }
     return manager;
 }
 
@@ -90,6 +145,16 @@ void stream_manager_destroy(stream_manager_t *manager) {
     }
     host_manager_unregister_listener(manager->host_manager, &host_manager_listener);
     listeners_list_destroy(manager->listeners);
+    if (manager->replay != NULL) {
+        es_replay_stop(manager->replay);
+    }
+    if (manager->recorder != NULL) {
+        es_recorder_destroy(manager->recorder);
+    }
+    if (manager->audio_worker != NULL) {
+        stream_worker_destroy(manager->audio_worker);
+        stream_worker_destroy(manager->video_worker);
+    }
     free(manager);
 }
 
@@ -108,6 +173,8 @@ bool stream_manager_start(stream_manager_t *manager, const IHS_HostInfo *host) {
     }
     manager->state.code = STREAM_MANAGER_STATE_REQUESTING;
     manager->state.requesting.host = *host;
+    // Platform decoder setup overlaps with the streaming request and connection
+    module_prewarm(false);
     host_manager_request_session(manager->host_manager, host);
     return true;
 }
@@ -126,6 +193,27 @@ void stream_manager_stop_active(stream_manager_t *manager) {
     IHS_SessionDisconnect(manager->state.streaming.session);
 }
 
+void stream_manager_suspend(stream_manager_t *manager) {
+    if (manager->state.code != STREAM_MANAGER_STATE_STREAMING || manager->suspended) {
+        return;
+    }
+    manager->suspended = true;
+    app_ihs_log(IHS_LogLevelInfo, "StreamManager", "Suspending media pipeline");
+    module_suspend();
+}
+
+void stream_manager_resume(stream_manager_t *manager) {
+    if (!manager->suspended) {
+        return;
+    }
+    manager->suspended = false;
+    if (manager->state.code != STREAM_MANAGER_STATE_STREAMING) {
+        return;
+    }
+    app_ihs_log(IHS_LogLevelInfo, "StreamManager", "Resuming media pipeline");
+    module_resume();
+}
+
 static void session_started(const IHS_SessionInfo *info, void *context) {
     stream_manager_t *manager = (stream_manager_t *) context;
     if (manager->state.code != STREAM_MANAGER_STATE_REQUESTING) {
@@ -137,8 +225,8 @@ static void session_started(const IHS_SessionInfo *info, void *context) {
     IHS_Session *session = IHS_SessionCreate(&manager->app->client_config, info);
     IHS_SessionSetLogFunction(session, app_ihs_log);
     IHS_SessionSetSessionCallbacks(session, &session_callbacks, manager);
-    IHS_SessionSetAudioCallbacks(session, module_audio_callbacks(), NULL);
-    IHS_SessionSetVideoCallbacks(session, module_video_callbacks(), NULL);
+    IHS_SessionSetAudioCallbacks(session, manager->audio_callbacks, manager->audio_context);
+    IHS_SessionSetVideoCallbacks(session, manager->video_callbacks, manager->video_context);
     manager->state.code = STREAM_MANAGER_STATE_CONNECTING;
     app_ihs_log(IHS_LogLevelInfo, "StreamManager", "Change state to CONNECTING");
     manager->state.streaming.session = session;
@@ -187,6 +275,7 @@ static void session_disconnected(IHS_Session *session, void *context) {
     assert(manager->state.code == STREAM_MANAGER_STATE_STREAMING);
     assert(manager->state.streaming.session == session);
     manager->state.code = STREAM_MANAGER_STATE_DISCONNECTING;
+    manager->suspended = false;
     app_ihs_log(IHS_LogLevelInfo, "StreamManager", "Change state to DISCONNECTING");
     event_context_t ec = {
             .manager = manager,
@@ -215,4 +304,14 @@ static void destroy_session_main(app_t *app, void *context) {
     IHS_Session *session = context;
     IHS_SessionThreadedJoin(session);
     IHS_SessionDestroy(session);
+}
+
+static void replay_finished(void *context) {
+    stream_manager_t *manager = context;
+    app_run_on_main(manager->app, replay_finished_main, NULL);
+}
+
+static void replay_finished_main(app_t *app, void *context) {
+    (void) context;
+    app_quit(app);
 }
\ No newline at end of file
@@ -27,3 +27,12 @@ bool stream_manager_start(stream_manager_t *manager, const IHS_HostInfo *host);
 IHS_Session *stream_manager_active_session(const stream_manager_t *manager);
 
 void stream_manager_stop_active(stream_manager_t *manager);
+
+/**
+ * Park the active session while the app is in background. Only the media pipeline is released, the session and its
+ * key stay alive so coming back doesn't need discovery and a new streaming request.
+ */
+void stream_manager_suspend(stream_manager_t *manager);
+
+void stream_manager_resume(stream_manager_t *manager);
+
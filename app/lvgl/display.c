@@ -1,9 +1,12 @@
 #include "display.h"
+#include "module.h"
 
 #include <src/draw/sdl/lv_draw_sdl.h>
 
 static void flush_cb(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t *src);
 
+static void compose_and_present(lv_disp_drv_t *disp_drv);
+
 lv_disp_t *app_lv_disp_init(SDL_Window *window) {
     int width, height;
     SDL_GetWindowSize(window, &width, &height);
@@ -39,16 +42,30 @@ static void flush_cb(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t
     }
 
     if (lv_disp_flush_is_last(disp_drv)) {
-        lv_draw_sdl_drv_param_t *param = disp_drv->user_data;
-        SDL_Renderer *renderer = param->renderer;
-        SDL_Texture *texture = disp_drv->draw_buf->buf1;
-        SDL_SetRenderTarget(renderer, NULL);
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-        SDL_RenderClear(renderer);
-        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-        SDL_RenderCopy(renderer, texture, NULL, NULL);
-        SDL_RenderPresent(renderer);
-        SDL_SetRenderTarget(renderer, texture);
+        compose_and_present(disp_drv);
     }
     lv_disp_flush_ready(disp_drv);
+}
+
+void app_lv_disp_present_video(lv_disp_t *disp) {
+    lv_draw_sdl_drv_param_t *param = disp->driver->user_data;
+    if (module_video_update(param->renderer)) {
+        // UI texture is already up to date, no need to wait for LVGL to redraw
+        compose_and_present(disp->driver);
+    }
+}
+
+static void compose_and_present(lv_disp_drv_t *disp_drv) {
+    lv_draw_sdl_drv_param_t *param = disp_drv->user_data;
+    SDL_Renderer *renderer = param->renderer;
+    SDL_Texture *texture = disp_drv->draw_buf->buf1;
+    SDL_SetRenderTarget(renderer, NULL);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+    module_video_draw(renderer);
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+    module_video_presented();
+    SDL_SetRenderTarget(renderer, texture);
 }
\ No newline at end of file
@@ -4,3 +4,8 @@
 #include <SDL.h>
 
 lv_disp_t *app_lv_disp_init(SDL_Window *window);
+
+/**
+ * Present a new video frame from software decoding module, if there is one.
+ */
+void app_lv_disp_present_video(lv_disp_t *disp);
@@ -20,7 +20,9 @@ static app_t *app = NULL;
 int main(int argc, char *argv[]) {
     (void) argc;
     (void) argv;
-    module_init(argc, argv);
+    if (!module_init(argc, argv)) {
+        return 1;
+    }
     IHS_Init();
     SDL_Init(SDL_INIT_VIDEO);
     SDL_RegisterEvents(APP_EVENT_SIZE);
@@ -38,6 +40,7 @@ int main(int argc, char *argv[]) {
     SDL_Window *window = SDL_CreateWindow("myapp", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, w, h,
                                           SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_FULLSCREEN);
     module_post_init(argc, argv);
+    module_prewarm(true);
 
     lv_disp_t *disp = app_lv_disp_init(window);
     lv_disp_set_default(disp);
@@ -54,10 +57,12 @@ int main(int argc, char *argv[]) {
     while (app->running) {
         process_events();
         lv_task_handler();
+        app_lv_disp_present_video(disp);
         SDL_Delay(1);
     }
 
     app_destroy(app);
+    module_deinit();
 
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -135,6 +140,29 @@ static void process_events() {
                 }
                 break;
             }
+            case SDL_APP_WILLENTERBACKGROUND: {
+                stream_manager_suspend(app->stream_manager);
+                break;
+            }
+            case SDL_APP_DIDENTERFOREGROUND: {
+                stream_manager_resume(app->stream_manager);
+                break;
+            }
+            case SDL_WINDOWEVENT: {
+                switch (event.window.event) {
+                    case SDL_WINDOWEVENT_HIDDEN:
+                    case SDL_WINDOWEVENT_MINIMIZED:
+                        stream_manager_suspend(app->stream_manager);
+                        break;
+                    case SDL_WINDOWEVENT_SHOWN:
+                    case SDL_WINDOWEVENT_RESTORED:
+                        stream_manager_resume(app->stream_manager);
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            }
             case SDL_QUIT: {
                 app_quit(app);
                 break;
@@ -0,0 +1,286 @@
+#include "module.h"
+#include "annexb.h"
+#include "sps_parser.h"
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Hardware decoders first, software decoding as the fallback. The null module is only loaded by name */
+static const char *const module_priority[] = {"ndl2", "ndl", "raspi", "ffmpeg"};
+
+static void *module_handle = NULL;
+static const ihsplay_module_t *module = NULL;
+
+/* Stream start waits on this while a pre-warm is running */
+static pthread_mutex_t prewarm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prewarm_done = PTHREAD_COND_INITIALIZER;
+static bool prewarm_running = false;
+
+/* Module callbacks, wrapped so start can wait for the pre-warm */
+static const IHS_StreamAudioCallbacks *module_audio = NULL;
+static const IHS_StreamVideoCallbacks *module_video = NULL;
+
+static bool module_dir(char *dir, size_t size);
+
+static const ihsplay_module_t *module_open(const char *dir, const char *name, void **handle);
+
+static void *prewarm_run(void *arg);
+
+static void prewarm_wait();
+
+static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context);
+
+static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context);
+
+static void audio_stop(IHS_Session *session, void *context);
+
+static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context);
+
+static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context);
+
+static void video_stop(IHS_Session *session, void *context);
+
+static const IHS_StreamAudioCallbacks audio_callbacks = {
+        .start = audio_start,
+        .submit = audio_submit,
+        .stop = audio_stop,
+};
+
+static const IHS_StreamVideoCallbacks video_callbacks = {
+        .start = video_start,
+        .submit = video_submit,
+        .stop = video_stop,
+};
+
+static long long ticks_ms();
+
+bool module_init(int argc, char *argv[]) {
+    char dir[PATH_MAX];
+    if (!module_dir(dir, sizeof(dir))) {
+        fprintf(stderr, "Can't find module directory\n");
+        return false;
+    }
+    const char *forced = getenv("IHSPLAY_MODULE");
+    if (forced != NULL) {
+        module = module_open(dir, forced, &module_handle);
+    } else {
+        for (int i = 0; i < sizeof(module_priority) / sizeof(module_priority[0]) && module == NULL; i++) {
+            module = module_open(dir, module_priority[i], &module_handle);
+        }
+    }
+    if (module == NULL) {
+        fprintf(stderr, "No usable decoder module in %s\n", dir);
+        return false;
+    }
+    printf("Using %s module\n", module->name);
+    if (module->init != NULL) {
+        module->init(argc, argv);
+    }
+    return true;
+}
+
+void module_post_init(int argc, char *argv[]) {
+    if (module->post_init != NULL) {
+        module->post_init(argc, argv);
+    }
+    // Parsers every module shares, module specific benchmarks stay in the module
+    if (getenv("IHSPLAY_SPS_BENCHMARK") != NULL) {
+        sps_parser_benchmark();
+    }
+    if (getenv("IHSPLAY_ANNEXB_BENCHMARK") != NULL) {
+        annexb_benchmark();
+    }
+}
+
+void module_prewarm(bool startup) {
+    if (module->prewarm == NULL) {
+        return;
+    }
+    const char *when = getenv("IHSPLAY_PREWARM");
+    if (when != NULL && strcmp(when, "off") == 0) {
+        return;
+    }
+    if (startup && (when == NULL || strcmp(when, "startup") != 0)) {
+        return;
+    }
+    pthread_mutex_lock(&prewarm_lock);
+    // Pre-warms keep what's already up, so one still running covers this request
+    if (!prewarm_running) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, prewarm_run, NULL) == 0) {
+            pthread_detach(thread);
+            prewarm_running = true;
+        }
+    }
+    pthread_mutex_unlock(&prewarm_lock);
+}
+
+void module_deinit() {
+    prewarm_wait();
+    if (module->deinit != NULL) {
+        module->deinit();
+    }
+}
+
+const IHS_StreamAudioCallbacks *module_audio_callbacks() {
+    module_audio = module->audio();
+    return &audio_callbacks;
+}
+
+const IHS_StreamVideoCallbacks *module_video_callbacks() {
+    module_video = module->video();
+    return &video_callbacks;
+}
+
+void module_audio_arrival(long long us) {
+    if (module->audio_arrival != NULL) {
+        module->audio_arrival(us);
+    }
+}
+
+void module_video_arrival(long long us) {
+    if (module->video_arrival != NULL) {
+        module->video_arrival(us);
+    }
+}
+
+void module_suspend() {
+    if (module->suspend != NULL) {
+        module->suspend();
+    }
+}
+
+void module_resume() {
+    if (module->resume != NULL) {
+        module->resume();
+    }
+}
+
+bool module_video_update(struct SDL_Renderer *renderer) {
+    // Modules presenting on a hardware plane have nothing to update
+    return module->video_update != NULL && module->video_update(renderer);
+}
+
+void module_video_draw(struct SDL_Renderer *renderer) {
+    if (module->video_draw != NULL) {
+        module->video_draw(renderer);
+    }
+}
+
+void module_video_presented() {
+    if (module->video_presented != NULL) {
+        module->video_presented();
+    }
+}
+
+static void *prewarm_run(void *arg) {
+    (void) arg;
+    long long begin = ticks_ms();
+    module->prewarm();
+    printf("%s module pre-warmed in %lld ms\n", module->name, ticks_ms() - begin);
+    pthread_mutex_lock(&prewarm_lock);
+    prewarm_running = false;
+    pthread_cond_broadcast(&prewarm_done);
+    pthread_mutex_unlock(&prewarm_lock);
+    return NULL;
+}
+
+static void prewarm_wait() {
+    pthread_mutex_lock(&prewarm_lock);
+    while (prewarm_running) {
+        pthread_cond_wait(&prewarm_done, &prewarm_lock);
+    }
+    pthread_mutex_unlock(&prewarm_lock);
+}
+
+static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context) {
+    // Whatever the pre-warm brought up is ready to be adopted once it returns
+    prewarm_wait();
+    return module_audio->start(session, config, context);
+}
+
+static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context) {
+    return module_audio->submit(session, data, context);
+}
+
+static void audio_stop(IHS_Session *session, void *context) {
+    module_audio->stop(session, context);
+}
+
+static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context) {
+    prewarm_wait();
+    return module_video->start(session, config, context);
+}
+
+static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context) {
+    return module_video->submit(session, data, flags, context);
+}
+
+static void video_stop(IHS_Session *session, void *context) {
+    module_video->stop(session, context);
+}
+
+static long long ticks_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Modules sit next to the executable, unless IHSPLAY_MODULE_DIR says otherwise.
+ */
+static bool module_dir(char *dir, size_t size) {
+    const char *env = getenv("IHSPLAY_MODULE_DIR");
+    if (env != NULL) {
+        snprintf(dir, size, "%s", env);
+        return true;
+    }
+    ssize_t len = readlink("/proc/self/exe", dir, size - 1);
+    if (len <= 0) {
+        return false;
+    }
+    dir[len] = '\0';
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        return false;
+    }
+    *slash = '\0';
+    return true;
+}
+
+/**
+ * @return Module table if the module and all its libraries loaded, and its probe passed
+ */
+static const ihsplay_module_t *module_open(const char *dir, const char *name, void **handle) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/libihsplay-mod-%s.so", dir, name);
+    if (access(path, F_OK) != 0) {
+        // Not part of this build
+        return NULL;
+    }
+    // Resolve everything now, so a module built against a library this device lacks fails here and not mid-stream
+    void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (lib == NULL) {
+        printf("Module %s unavailable: %s\n", name, dlerror());
+        return NULL;
+    }
+    const ihsplay_module_t *table = dlsym(lib, IHSPLAY_MODULE_SYMBOL);
+    if (table == NULL) {
+        fprintf(stderr, "%s has no module table\n", path);
+        dlclose(lib);
+        return NULL;
+    }
+    if (table->probe != NULL && !table->probe()) {
+        printf("Module %s unsupported on this device\n", name);
+        dlclose(lib);
+        return NULL;
+    }
+    *handle = lib;
+    return table;
+}
@@ -1,4 +1,5 @@
 install(TARGETS ihsplay RUNTIME DESTINATION .)
+install(TARGETS ${IHSPLAY_MODULES} LIBRARY DESTINATION .)
 install(DIRECTORY ${CMAKE_SOURCE_DIR}/deploy/webos/ DESTINATION .)
 
 set(CPACK_PACKAGE_NAME "org.mariotaku.ihsplay")
@@ -0,0 +1,235 @@
+// Annex B start code scanning. Start codes are searched 16 bytes at a time with SSE2 or NEON where available
+
+#include "annexb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#define ANNEXB_SSE2 1
+
+#include <emmintrin.h>
+
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define ANNEXB_NEON 1
+
+#include <arm_neon.h>
+
+#endif
+
+typedef const uint8_t *(*start_code_finder_fn)(const uint8_t *p, const uint8_t *end);
+
+/**
+ * @return Pointer to the first byte of 00 00 01 in [p, end), or end
+ */
+static const uint8_t *find_start_code_scalar(const uint8_t *p, const uint8_t *end) {
+    for (; end - p >= 3; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            return p;
+        }
+    }
+    return end;
+}
+
+#if ANNEXB_SSE2
+
+static const uint8_t *find_start_code_sse2(const uint8_t *p, const uint8_t *end) {
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+    // Each position needs 2 bytes past the 16 tested
+    while (end - p >= 18) {
+        __m128i b0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), zero);
+        __m128i b1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 1)), zero);
+        __m128i b2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 2)), one);
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(b0, b1), b2));
+        if (mask != 0) {
+            return p + __builtin_ctz((unsigned int) mask);
+        }
+        p += 16;
+    }
+    return find_start_code_scalar(p, end);
+}
+
+#endif
+
+#if ANNEXB_NEON
+
+static const uint8_t *find_start_code_neon(const uint8_t *p, const uint8_t *end) {
+    const uint8x16_t zero = vdupq_n_u8(0), one = vdupq_n_u8(1);
+    while (end - p >= 18) {
+        uint8x16_t b0 = vceqq_u8(vld1q_u8(p), zero);
+        uint8x16_t b1 = vceqq_u8(vld1q_u8(p + 1), zero);
+        uint8x16_t b2 = vceqq_u8(vld1q_u8(p + 2), one);
+        uint8x16_t match = vandq_u8(vandq_u8(b0, b1), b2);
+        // No movemask on NEON, narrow every byte to a nibble instead
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+        if (mask != 0) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+        p += 16;
+    }
+    return find_start_code_scalar(p, end);
+}
+
+#endif
+
+#if ANNEXB_SSE2
+static const start_code_finder_fn find_start_code = find_start_code_sse2;
+#elif ANNEXB_NEON
+static const start_code_finder_fn find_start_code = find_start_code_neon;
+#else
+static const start_code_finder_fn find_start_code = find_start_code_scalar;
+#endif
+
+uint8_t annexb_nal_type(IHS_StreamVideoCodec codec, uint8_t header) {
+    if (codec == IHS_StreamVideoCodecHEVC) {
+        return (header >> 1) & 0x3F;
+    }
+    return header & 0x1F;
+}
+
+static size_t next_with(start_code_finder_fn finder, const uint8_t *data, size_t size, size_t from) {
+    if (from >= size) {
+        return size;
+    }
+    const uint8_t *start = finder(data + from, data + size);
+    if (data + size - start <= 3) {
+        return size;
+    }
+    return start - data + 3;
+}
+
+size_t annexb_next(const uint8_t *data, size_t size, size_t from) {
+    return next_with(find_start_code, data, size, from);
+}
+
+/**
+ * @return End of NAL unit starting at offset, given the offset of the one after it
+ */
+static size_t unit_end(const uint8_t *data, size_t size, size_t offset, size_t next) {
+    size_t end = next < size ? next - 3 : size;
+    // Zero byte of a 4 byte start code, or trailing_zero_8bits
+    while (end > offset && data[end - 1] == 0) {
+        end--;
+    }
+    return end;
+}
+
+static size_t scan_with(start_code_finder_fn finder, const uint8_t *data, size_t size, IHS_StreamVideoCodec codec,
+                        nal_unit_t *units, size_t max_units) {
+    size_t count = 0;
+    size_t offset = next_with(finder, data, size, 0);
+    while (offset < size && count < max_units) {
+        size_t next = next_with(finder, data, size, offset);
+        units[count].offset = offset;
+        units[count].size = unit_end(data, size, offset, next) - offset;
+        units[count].type = annexb_nal_type(codec, data[offset]);
+        count++;
+        offset = next;
+    }
+    return count;
+}
+
+size_t annexb_scan(const uint8_t *data, size_t size, IHS_StreamVideoCodec codec, nal_unit_t *units,
+                   size_t max_units) {
+    return scan_with(find_start_code, data, size, codec, units, max_units);
+}
+
+size_t annexb_unit_size(const uint8_t *data, size_t size, size_t offset) {
+    return unit_end(data, size, offset, annexb_next(data, size, offset)) - offset;
+}
+
+bool annexb_find(const uint8_t *data, size_t size, IHS_StreamVideoCodec codec, uint8_t type, nal_unit_t *unit) {
+    for (size_t offset = annexb_next(data, size, 0); offset < size; offset = annexb_next(data, size, offset)) {
+        uint8_t cur_type = annexb_nal_type(codec, data[offset]);
+        if (cur_type == type) {
+            unit->offset = offset;
+            unit->size = annexb_unit_size(data, size, offset);
+            unit->type = type;
+            return true;
+        }
+        if (annexb_is_slice(codec, cur_type)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool annexb_is_slice(IHS_StreamVideoCodec codec, uint8_t type) {
+    if (codec == IHS_StreamVideoCodecHEVC) {
+        return type < NAL_TYPE_HEVC_VPS;
+    }
+    return type >= 1 && type <= NAL_TYPE_H264_IDR;
+}
+
+static long long benchmark_ticks_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void annexb_benchmark() {
+    static const struct {
+        const char *name;
+        /** One in this many bytes is zero */
+        int zero_ratio;
+    } patterns[] = {{"slice data", 256}, {"zero heavy", 4}};
+    const struct {
+        const char *name;
+        start_code_finder_fn finder;
+    } finders[] = {
+            {"scalar", find_start_code_scalar},
+#if ANNEXB_SSE2
+            {"sse2", find_start_code_sse2},
+#endif
+#if ANNEXB_NEON
+            {"neon", find_start_code_neon},
+#endif
+    };
+    const size_t size = 4 << 20;
+    const int iterations = 20;
+    uint8_t *data = malloc(size);
+    nal_unit_t *units = malloc(sizeof(nal_unit_t) * 1024);
+    if (data == NULL || units == NULL) {
+        free(data);
+        free(units);
+        return;
+    }
+    printf("Annex B start code scanning, GB/s over %zu MB with a NAL unit every 64 KB\n", size >> 20);
+    for (int t = 0; t < sizeof(patterns) / sizeof(patterns[0]); t++) {
+        srand(1);
+        for (size_t i = 0; i < size; i++) {
+            int value = rand();
+            data[i] = value % patterns[t].zero_ratio == 0 ? 0 : (uint8_t) (value >> 8 | 4);
+        }
+        // Escape what the random fill produced, then lay out slices
+        for (size_t i = 2; i < size; i++) {
+            if (data[i - 2] == 0 && data[i - 1] == 0 && data[i] <= 3) {
+                data[i] = 3;
+            }
+        }
+        for (size_t i = 0; i + 5 < size; i += 65536) {
+            data[i] = data[i + 1] = data[i + 2] = 0;
+            data[i + 3] = 1;
+            data[i + 4] = 0x65;
+        }
+        printf("  %s:", patterns[t].name);
+        size_t expected = 0;
+        for (int f = 0; f < sizeof(finders) / sizeof(finders[0]); f++) {
+            size_t count = 0;
+            long long begin = benchmark_ticks_ns();
+            for (int i = 0; i < iterations; i++) {
+                count = scan_with(finders[f].finder, data, size, IHS_StreamVideoCodecH264, units, 1024);
+            }
+            double seconds = (double) (benchmark_ticks_ns() - begin) / 1e9;
+            if (f == 0) {
+                expected = count;
+            }
+            printf(" %s %.2f%s", finders[f].name, (double) size * iterations / seconds / 1e9,
+                   count == expected ? "" : " MISMATCH");
+        }
+        printf("\n");
+    }
+    free(units);
+    free(data);
+}
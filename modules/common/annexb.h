@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <ihslib.h>
+
+#define NAL_TYPE_H264_IDR 5
+#define NAL_TYPE_H264_SEI 6
+#define NAL_TYPE_H264_SPS 7
+#define NAL_TYPE_H264_PPS 8
+#define NAL_TYPE_H264_AUD 9
+
+#define NAL_TYPE_HEVC_IDR_W_RADL 19
+#define NAL_TYPE_HEVC_IDR_N_LP 20
+#define NAL_TYPE_HEVC_VPS 32
+#define NAL_TYPE_HEVC_SPS 33
+#define NAL_TYPE_HEVC_PPS 34
+#define NAL_TYPE_HEVC_AUD 35
+#define NAL_TYPE_HEVC_PREFIX_SEI 39
+
+typedef struct nal_unit_t {
+    /** Offset of NAL header, right after the start code */
+    size_t offset;
+    /** Bytes up to the next start code or end of frame, without trailing zero bytes */
+    size_t size;
+    uint8_t type;
+} nal_unit_t;
+
+uint8_t annexb_nal_type(IHS_StreamVideoCodec codec, uint8_t header);
+
+/**
+ * Whether a NAL type carries slice data. Everything a decoder needs to set up comes before the first one.
+ */
+bool annexb_is_slice(IHS_StreamVideoCodec codec, uint8_t type);
+
+/**
+ * @return Offset of the first NAL header after a 3 or 4 byte start code at or after from, or size if there is none
+ */
+size_t annexb_next(const uint8_t *data, size_t size, size_t from);
+
+/**
+ * @param offset NAL header offset, as returned by annexb_next
+ * @return Bytes of the NAL unit up to the next start code, without trailing zero bytes
+ */
+size_t annexb_unit_size(const uint8_t *data, size_t size, size_t offset);
+
+/**
+ * Index NAL units of an Annex B frame, without copying. Stops after max_units.
+ *
+ * @return Number of NAL units found
+ */
+size_t annexb_scan(const uint8_t *data, size_t size, IHS_StreamVideoCodec codec, nal_unit_t *units,
+                   size_t max_units);
+
+/**
+ * Find the first NAL unit of a type. Parameter sets come before slices, so this stops at the first slice
+ * instead of scanning the whole frame.
+ */
+bool annexb_find(const uint8_t *data, size_t size, IHS_StreamVideoCodec codec, uint8_t type, nal_unit_t *unit);
+
+/**
+ * Print start code scanning throughput of the scalar and SIMD scanners.
+ */
+void annexb_benchmark();
@@ -0,0 +1,110 @@
+#include "audio_gap.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Packets per block, the minimum covers about 2 seconds of 5 ms packets */
+#define GAP_BLOCK_PACKETS 50
+/* Nothing is concealed until the minimum has seen this many packets */
+#define GAP_WARMUP_PACKETS 40
+/* Longer gaps are a stall rather than loss, concealing them would only add latency */
+#define GAP_MAX_PACKETS 4
+
+#define LAG_NONE INT64_MAX
+
+static void lag_window(const audio_gap_t *gap, long long *minimum, long long *jitter);
+
+void audio_gap_init(audio_gap_t *gap, int rate) {
+    gap->rate = rate;
+    memset(&gap->stats, 0, sizeof(gap->stats));
+    audio_gap_reset(gap);
+}
+
+void audio_gap_reset(audio_gap_t *gap) {
+    gap->base = 0;
+    gap->media = 0;
+    gap->packets = 0;
+    gap->block = 0;
+    gap->block_packets = 0;
+    for (int i = 0; i < AUDIO_GAP_BLOCKS; i++) {
+        gap->block_min[i] = LAG_NONE;
+        gap->block_jitter[i] = 0;
+    }
+}
+
+long audio_gap_update(audio_gap_t *gap, long long arrival, int frames) {
+    if (frames <= 0) {
+        return 0;
+    }
+    if (gap->packets++ == 0) {
+        gap->base = arrival;
+    }
+    long long duration = (long long) frames * 1000000 / gap->rate;
+    long long lag = arrival - gap->base - gap->media * 1000000 / gap->rate;
+    long long minimum, jitter;
+    lag_window(gap, &minimum, &jitter);
+    long missing = 0;
+    if (minimum != LAG_NONE) {
+        if (lag < minimum - duration / 2) {
+            // Packets before this one were late and concealed, not lost
+            gap->base -= minimum - lag;
+            lag = minimum;
+            gap->stats.rebased++;
+        } else if (gap->packets > GAP_WARMUP_PACKETS && lag - minimum >= duration) {
+            // Lost packets plus lateness within the recent jitter add up to the lag, take the count both allow.
+            // Lateness beyond the recent jitter can't be told apart from loss, and isn't concealed.
+            long long lost = (lag - minimum) / duration;
+            long long lost_after_jitter = (lag - minimum - jitter + duration - 1) / duration;
+            if (lost_after_jitter < lost) {
+                lost = lost_after_jitter;
+            }
+            if (lost > GAP_MAX_PACKETS) {
+                gap->base += lag - minimum;
+                lag = minimum;
+                gap->stats.stalls++;
+            } else if (lost > 0) {
+                missing = (long) lost * frames;
+                lag -= lost * duration;
+                gap->stats.gaps++;
+                gap->stats.concealed += missing;
+            }
+        }
+    }
+    gap->media += missing + frames;
+
+    if (lag < gap->block_min[gap->block]) {
+        gap->block_min[gap->block] = lag;
+    }
+    if (minimum != LAG_NONE && lag - minimum > gap->block_jitter[gap->block]) {
+        gap->block_jitter[gap->block] = lag - minimum;
+    }
+    if (++gap->block_packets == GAP_BLOCK_PACKETS) {
+        gap->block_packets = 0;
+        gap->block = (gap->block + 1) % AUDIO_GAP_BLOCKS;
+        gap->block_min[gap->block] = LAG_NONE;
+        gap->block_jitter[gap->block] = 0;
+    }
+    return missing;
+}
+
+void audio_gap_print_stats(const audio_gap_t *gap) {
+    if (gap->packets == 0) {
+        return;
+    }
+    printf("Audio gaps: %llu gaps, %.1f ms concealed, %llu late bursts, %llu stalls\n",
+           (unsigned long long) gap->stats.gaps, (double) gap->stats.concealed * 1000.0 / gap->rate,
+           (unsigned long long) gap->stats.rebased, (unsigned long long) gap->stats.stalls);
+}
+
+static void lag_window(const audio_gap_t *gap, long long *minimum, long long *jitter) {
+    *minimum = LAG_NONE;
+    *jitter = 0;
+    for (int i = 0; i < AUDIO_GAP_BLOCKS; i++) {
+        if (gap->block_min[i] < *minimum) {
+            *minimum = gap->block_min[i];
+        }
+        if (gap->block_jitter[i] > *jitter) {
+            *jitter = gap->block_jitter[i];
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Lag minimum is kept per block of packets, over this many blocks */
+#define AUDIO_GAP_BLOCKS 8
+
+/**
+ * Finds lost audio packets from arrival times, since packets carry no sequence number by the time they reach a
+ * module. Each packet advances a media clock by its duration. Arrival lag against that clock stays near its recent
+ * minimum, and lost packets show up as lag that grows by whole packet durations. Only lag beyond the recent jitter
+ * counts, so on a link that jitters by more than a packet some losses go unnoticed rather than late packets being
+ * concealed.
+ *
+ * Packets that were only late arrive early against the clock afterwards, the clock is rebased on those instead of
+ * being taken as the new minimum. Audio concealed for them is extra latency, and left to the drift controller.
+ */
+typedef struct audio_gap_t {
+    int rate;
+    /** Arrival time of the first packet, microseconds */
+    long long base;
+    /** Frames received or concealed since the first packet */
+    long long media;
+    long long block_min[AUDIO_GAP_BLOCKS];
+    /** Highest lag above the minimum, once losses are taken out */
+    long long block_jitter[AUDIO_GAP_BLOCKS];
+    int block, block_packets;
+    long packets;
+
+    struct {
+        uint64_t gaps;
+        uint64_t concealed;
+        uint64_t rebased;
+        uint64_t stalls;
+    } stats;
+} audio_gap_t;
+
+void audio_gap_init(audio_gap_t *gap, int rate);
+
+/**
+ * Call after a stream restart, e.g. resume, before the next packet.
+ */
+void audio_gap_reset(audio_gap_t *gap);
+
+/**
+ * @param arrival Arrival time of the packet in microseconds, CLOCK_MONOTONIC
+ * @param frames Duration of the packet in frames
+ * @return Frames missing before this packet, in whole packets of this duration. They are assumed to be concealed.
+ */
+long audio_gap_update(audio_gap_t *gap, long long arrival, int frames);
+
+void audio_gap_print_stats(const audio_gap_t *gap);
@@ -0,0 +1,61 @@
+#include "audio_packet.h"
+
+uint32_t opus_packet_samples(const uint8_t *data, size_t size, uint32_t rate) {
+    if (size < 1) {
+        return 0;
+    }
+    // Frame duration in units of 2.5 ms
+    static const uint8_t silk_durations[4] = {4, 8, 16, 24};
+    static const uint8_t hybrid_durations[2] = {4, 8};
+    static const uint8_t celt_durations[4] = {1, 2, 4, 8};
+    uint8_t config = data[0] >> 3;
+    uint32_t duration;
+    if (config < 12) {
+        duration = silk_durations[config & 3];
+    } else if (config < 16) {
+        duration = hybrid_durations[config & 1];
+    } else {
+        duration = celt_durations[config & 3];
+    }
+    uint32_t frames;
+    switch (data[0] & 3) {
+        case 0:
+            frames = 1;
+            break;
+        case 1:
+        case 2:
+            frames = 2;
+            break;
+        default:
+            if (size < 2) {
+                return 0;
+            }
+            frames = data[1] & 0x3F;
+            break;
+    }
+    // Packets are at most 120 ms, a longer frame count is a corrupt packet
+    if (frames * duration > 48) {
+        return 0;
+    }
+    return frames * duration * rate / 400;
+}
+
+uint32_t mp3_frame_samples(const uint8_t *data, size_t size) {
+    if (size < 4 || data[0] != 0xFF || (data[1] & 0xE0) != 0xE0) {
+        return 0;
+    }
+    uint8_t version = (data[1] >> 3) & 3, layer = (data[1] >> 1) & 3;
+    switch (layer) {
+        case 3:
+            // Layer I
+            return 384;
+        case 2:
+            // Layer II
+            return 1152;
+        case 1:
+            // Layer III, MPEG-2 and 2.5 have half the samples
+            return version == 3 ? 1152 : 576;
+        default:
+            return 0;
+    }
+}
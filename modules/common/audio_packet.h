@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Samples per channel in an Opus packet, from its TOC byte (RFC 6716 section 3.1).
+ *
+ * @return 0 if the packet is malformed or longer than 120 ms
+ */
+uint32_t opus_packet_samples(const uint8_t *data, size_t size, uint32_t rate);
+
+/**
+ * Samples per channel in an MPEG audio frame, from its header.
+ */
+uint32_t mp3_frame_samples(const uint8_t *data, size_t size);
@@ -0,0 +1,105 @@
+#include "backpressure.h"
+#include "annexb.h"
+#include "module.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define IDR_INTERVAL_US 500000
+
+static long long ticks_us();
+
+void backpressure_init(backpressure_t *bp, IHS_StreamVideoCodec codec) {
+    memset(bp, 0, sizeof(backpressure_t));
+    bp->codec = codec;
+    bp->idr_interval_us = IDR_INTERVAL_US;
+}
+
+bool backpressure_admit(backpressure_t *bp, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, bool backlogged,
+                        int *result) {
+    bp->stats.frames++;
+    *result = DR_OK;
+    if (flags & IHS_StreamVideoFrameKeyFrame) {
+        bp->reference_lost = false;
+        return true;
+    }
+    if (bp->reference_lost) {
+        // Would only decode into garbage. Ask again if the previous request went unanswered
+        bp->stats.dropped_broken++;
+        *result = backpressure_request_idr(bp);
+        return false;
+    }
+    if (backlogged && !video_frame_is_reference(bp->codec, IHS_BufferPointer(data), data->size)) {
+        bp->stats.dropped_non_reference++;
+        return false;
+    }
+    return true;
+}
+
+int backpressure_lost(backpressure_t *bp, IHS_Buffer *data) {
+    if (!video_frame_is_reference(bp->codec, IHS_BufferPointer(data), data->size)) {
+        bp->stats.dropped_non_reference++;
+        return DR_OK;
+    }
+    bp->stats.references_lost++;
+    bp->reference_lost = true;
+    return backpressure_request_idr(bp);
+}
+
+void backpressure_print_stats(const backpressure_t *bp) {
+    if (bp->stats.frames == 0) {
+        return;
+    }
+    printf("Video backpressure: %llu frames, %llu non-reference dropped, %llu references lost, %llu dropped "
+           "waiting for key frame, %llu IDR requests, %llu throttled\n", (unsigned long long) bp->stats.frames,
+           (unsigned long long) bp->stats.dropped_non_reference, (unsigned long long) bp->stats.references_lost,
+           (unsigned long long) bp->stats.dropped_broken, (unsigned long long) bp->stats.idr_requests,
+           (unsigned long long) bp->stats.idr_throttled);
+}
+
+bool video_frame_is_reference(IHS_StreamVideoCodec codec, const uint8_t *data, size_t size) {
+    if (codec != IHS_StreamVideoCodecH264 && codec != IHS_StreamVideoCodecHEVC) {
+        return true;
+    }
+    // Walk Annex B start codes up to the first slice
+    for (size_t offset = annexb_next(data, size, 0); offset < size; offset = annexb_next(data, size, offset)) {
+        uint8_t header = data[offset];
+        uint8_t type = annexb_nal_type(codec, header);
+        if (codec == IHS_StreamVideoCodecH264) {
+            if (type >= 1 && type <= NAL_TYPE_H264_IDR) {
+                return (header >> 5) != 0;
+            }
+            if (type == NAL_TYPE_H264_SPS || type == NAL_TYPE_H264_PPS) {
+                return true;
+            }
+        } else {
+            if (type < NAL_TYPE_HEVC_VPS) {
+                // TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and reserved RSV_VCL_N are sub-layer non-reference
+                return type >= 16 || (type & 1) != 0;
+            }
+            if (type <= NAL_TYPE_HEVC_PPS) {
+                // Parameter sets
+                return true;
+            }
+        }
+    }
+    return true;
+}
+
+int backpressure_request_idr(backpressure_t *bp) {
+    long long now = ticks_us();
+    if (bp->last_idr_request != 0 && now - bp->last_idr_request < bp->idr_interval_us) {
+        bp->stats.idr_throttled++;
+        return DR_OK;
+    }
+    bp->last_idr_request = now;
+    bp->stats.idr_requests++;
+    return DR_NEED_IDR;
+}
+
+static long long ticks_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
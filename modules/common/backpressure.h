@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ihslib.h"
+
+/**
+ * Frame dropping and key frame request policy shared by video modules.
+ *
+ * Under decoder backlog, frames nothing else refers to are dropped first. Once a reference frame is lost, everything
+ * up to the next key frame is dropped, and key frames are requested no more often than the throttle interval.
+ */
+typedef struct backpressure_t {
+    IHS_StreamVideoCodec codec;
+    bool reference_lost;
+    long long idr_interval_us;
+    long long last_idr_request;
+
+    struct {
+        uint64_t frames;
+        uint64_t dropped_non_reference;
+        uint64_t dropped_broken;
+        uint64_t references_lost;
+        uint64_t idr_requests;
+        uint64_t idr_throttled;
+    } stats;
+} backpressure_t;
+
+void backpressure_init(backpressure_t *bp, IHS_StreamVideoCodec codec);
+
+/**
+ * Decide whether a frame should go to the decoder.
+ *
+ * @param backlogged Decoder can't take another frame right now
+ * @param result What to return to ihslib if the frame is dropped
+ * @return true if the frame should be submitted
+ */
+bool backpressure_admit(backpressure_t *bp, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, bool backlogged,
+                        int *result);
+
+/**
+ * Frame was admitted, but the decoder didn't take it.
+ *
+ * @return What to return to ihslib
+ */
+int backpressure_lost(backpressure_t *bp, IHS_Buffer *data);
+
+/**
+ * Ask for a key frame, no more often than the throttle interval.
+ *
+ * @return What to return to ihslib
+ */
+int backpressure_request_idr(backpressure_t *bp);
+
+void backpressure_print_stats(const backpressure_t *bp);
+
+/**
+ * Whether later frames may depend on this one, judging from its NAL headers. Always true for codecs without them.
+ */
+bool video_frame_is_reference(IHS_StreamVideoCodec codec, const uint8_t *data, size_t size);
@@ -0,0 +1,103 @@
+#include "drift_ctl.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Smoothing per packet, about half a second of 5 ms packets. Network jitter moves the latency a lot more than drift */
+#define DRIFT_SMOOTHING 0.01
+/* Latency is left alone within this distance of the target */
+#define DRIFT_BAND_MS 2
+/* Stream has to run this long before the target is learned */
+#define DRIFT_WARMUP_MS 2000
+
+void drift_ctl_init(drift_ctl_t *ctl, int rate, int target_ms) {
+    ctl->rate = rate;
+    ctl->band = (long) rate * DRIFT_BAND_MS / 1000;
+    ctl->given_target = (long) rate * target_ms / 1000;
+    memset(&ctl->stats, 0, sizeof(ctl->stats));
+    ctl->stats.latency_min = -1;
+    drift_ctl_reset(ctl);
+}
+
+void drift_ctl_reset(drift_ctl_t *ctl) {
+    ctl->target = ctl->given_target;
+    ctl->smoothed = -1;
+    ctl->warmup = (long) ctl->rate * DRIFT_WARMUP_MS / 1000;
+}
+
+int drift_ctl_update(drift_ctl_t *ctl, long latency, size_t frames) {
+    ctl->stats.frames += frames;
+    if (ctl->smoothed < 0) {
+        ctl->smoothed = (double) latency;
+    } else {
+        ctl->smoothed += ((double) latency - ctl->smoothed) * DRIFT_SMOOTHING;
+    }
+    if (ctl->warmup > 0) {
+        // Also gives the smoothed value time to settle after a reset
+        ctl->warmup -= (long) frames;
+        if (ctl->warmup <= 0 && ctl->target == 0) {
+            ctl->target = (long) ctl->smoothed;
+            printf("Audio latency target locked at %.1f ms\n", (double) ctl->target * 1000.0 / ctl->rate);
+        }
+        return 0;
+    }
+    long current = (long) ctl->smoothed;
+    if (ctl->stats.latency_min < 0 || current < ctl->stats.latency_min) {
+        ctl->stats.latency_min = current;
+    }
+    if (current > ctl->stats.latency_max) {
+        ctl->stats.latency_max = current;
+    }
+    if (current > ctl->target + ctl->band) {
+        ctl->stats.dropped++;
+        // Corrected frame shows up in the smoothed value right away, instead of over the next packets
+        ctl->smoothed -= 1;
+        return -1;
+    } else if (current < ctl->target - ctl->band) {
+        ctl->stats.inserted++;
+        ctl->smoothed += 1;
+        return 1;
+    }
+    return 0;
+}
+
+size_t drift_ctl_apply(int16_t *pcm, size_t frames, size_t channels, int correction) {
+    if (correction == 0 || frames < 2) {
+        return frames;
+    }
+    size_t quietest = 0;
+    long quietest_level = -1;
+    for (size_t i = 0; i < frames; i++) {
+        long level = 0;
+        for (size_t c = 0; c < channels; c++) {
+            level += labs((long) pcm[i * channels + c]);
+        }
+        if (quietest_level < 0 || level < quietest_level) {
+            quietest = i;
+            quietest_level = level;
+        }
+    }
+    int16_t *at = pcm + quietest * channels;
+    size_t tail = (frames - quietest - 1) * channels * sizeof(int16_t);
+    if (correction > 0) {
+        // Frame is repeated
+        memmove(at + channels, at, tail + channels * sizeof(int16_t));
+        return frames + 1;
+    }
+    memmove(at, at + channels, tail);
+    return frames - 1;
+}
+
+void drift_ctl_print_stats(const drift_ctl_t *ctl) {
+    if (ctl->stats.frames == 0) {
+        return;
+    }
+    double ms_per_frame = 1000.0 / ctl->rate;
+    printf("Audio drift: target %.1f ms, held between %.1f ms and %.1f ms, %llu frames inserted, %llu dropped, "
+           "net %+.0f ppm\n", (double) ctl->target * ms_per_frame,
+           (double) (ctl->stats.latency_min < 0 ? 0 : ctl->stats.latency_min) * ms_per_frame,
+           (double) ctl->stats.latency_max * ms_per_frame, (unsigned long long) ctl->stats.inserted,
+           (unsigned long long) ctl->stats.dropped,
+           ((double) ctl->stats.inserted - (double) ctl->stats.dropped) * 1e6 / (double) ctl->stats.frames);
+}
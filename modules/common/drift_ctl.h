@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Keeps audio output latency steady while sender and sound card clocks drift apart. Latency is smoothed, and once it
+ * leaves a band around the target a single frame is inserted or dropped per packet, where the signal is quietest.
+ */
+typedef struct drift_ctl_t {
+    int rate;
+    /** Target given at init, 0 if it's learned */
+    long given_target;
+    /** Frames, 0 while the target is still being learned */
+    long target;
+    long band;
+    double smoothed;
+    /** Frames left to observe before the target is locked to the smoothed latency */
+    long warmup;
+
+    struct {
+        uint64_t frames;
+        uint64_t inserted;
+        uint64_t dropped;
+        long latency_min, latency_max;
+    } stats;
+} drift_ctl_t;
+
+/**
+ * @param target_ms Latency to hold, or 0 to hold whatever latency the stream settles at
+ */
+void drift_ctl_init(drift_ctl_t *ctl, int rate, int target_ms);
+
+/**
+ * Call after a stream restart, e.g. resume. Target is learned again unless it was given.
+ */
+void drift_ctl_reset(drift_ctl_t *ctl);
+
+/**
+ * @param latency Frames queued ahead of the speaker, device delay plus anything buffered before the device
+ * @param frames Frames in the packet about to be queued
+ * @return 1 to insert a frame, -1 to drop one, 0 to leave the packet alone
+ */
+int drift_ctl_update(drift_ctl_t *ctl, long latency, size_t frames);
+
+/**
+ * Insert or drop one frame at the quietest point of the packet, which is at or next to a zero crossing.
+ *
+ * @param pcm Interleaved samples, with room for frames + 1 when inserting
+ * @return New number of frames
+ */
+size_t drift_ctl_apply(int16_t *pcm, size_t frames, size_t channels, int correction);
+
+void drift_ctl_print_stats(const drift_ctl_t *ctl);
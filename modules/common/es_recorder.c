@@ -0,0 +1,184 @@
+#include "es_recorder.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+struct es_recorder_t {
+    const IHS_StreamVideoCallbacks *video;
+    void *video_context;
+    const IHS_StreamAudioCallbacks *audio;
+    void *audio_context;
+
+    /* Audio and video arrive on different threads */
+    pthread_mutex_t lock;
+    FILE *file;
+    long long begin;
+    bool failed;
+
+    struct {
+        uint64_t records;
+        uint64_t bytes;
+    } stats;
+};
+
+static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context);
+
+static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context);
+
+static void video_stop(IHS_Session *session, void *context);
+
+static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context);
+
+static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context);
+
+static void audio_stop(IHS_Session *session, void *context);
+
+static void write_record(es_recorder_t *recorder, es_record_type_t type, uint32_t flags, const void *payload,
+                         size_t size);
+
+static long long ticks_us();
+
+static const IHS_StreamVideoCallbacks recorder_video_callbacks = {
+        .start = video_start,
+        .submit = video_submit,
+        .stop = video_stop,
+};
+
+static const IHS_StreamAudioCallbacks recorder_audio_callbacks = {
+        .start = audio_start,
+        .submit = audio_submit,
+        .stop = audio_stop,
+};
+
+es_recorder_t *es_recorder_create(const char *path, const IHS_StreamVideoCallbacks *video, void *video_context,
+                                  const IHS_StreamAudioCallbacks *audio, void *audio_context) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Can't create recording %s\n", path);
+        return NULL;
+    }
+    es_file_header_t header = {
+            .version = ES_RECORD_VERSION,
+            .header_size = sizeof(es_file_header_t),
+    };
+    memcpy(header.magic, ES_RECORD_MAGIC, sizeof(header.magic));
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        return NULL;
+    }
+    es_recorder_t *recorder = calloc(1, sizeof(es_recorder_t));
+    recorder->video = video;
+    recorder->video_context = video_context;
+    recorder->audio = audio;
+    recorder->audio_context = audio_context;
+    pthread_mutex_init(&recorder->lock, NULL);
+    recorder->file = file;
+    recorder->begin = ticks_us();
+    printf("Recording elementary streams to %s\n", path);
+    return recorder;
+}
+
+void es_recorder_destroy(es_recorder_t *recorder) {
+    fclose(recorder->file);
+    printf("Recording closed: %llu records, %llu bytes\n", (unsigned long long) recorder->stats.records,
+           (unsigned long long) recorder->stats.bytes);
+    pthread_mutex_destroy(&recorder->lock);
+    free(recorder);
+}
+
+const IHS_StreamVideoCallbacks *es_recorder_video_callbacks() {
+    return &recorder_video_callbacks;
+}
+
+const IHS_StreamAudioCallbacks *es_recorder_audio_callbacks() {
+    return &recorder_audio_callbacks;
+}
+
+static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context) {
+    es_recorder_t *recorder = context;
+    es_video_config_t record = {
+            .codec = config->codec,
+            .width = config->width,
+            .height = config->height,
+    };
+    write_record(recorder, ES_RECORD_VIDEO_START, 0, &record, sizeof(record));
+    return recorder->video->start(session, config, recorder->video_context);
+}
+
+static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context) {
+    es_recorder_t *recorder = context;
+    write_record(recorder, ES_RECORD_VIDEO_FRAME, flags, IHS_BufferPointer(data), data->size);
+    return recorder->video->submit(session, data, flags, recorder->video_context);
+}
+
+static void video_stop(IHS_Session *session, void *context) {
+    es_recorder_t *recorder = context;
+    write_record(recorder, ES_RECORD_VIDEO_STOP, 0, NULL, 0);
+    recorder->video->stop(session, recorder->video_context);
+}
+
+static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context) {
+    es_recorder_t *recorder = context;
+    es_audio_config_t record = {
+            .codec = config->codec,
+            .channels = config->channels,
+            .frequency = config->frequency,
+    };
+    write_record(recorder, ES_RECORD_AUDIO_START, 0, &record, sizeof(record));
+    return recorder->audio->start(session, config, recorder->audio_context);
+}
+
+static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context) {
+    es_recorder_t *recorder = context;
+    write_record(recorder, ES_RECORD_AUDIO_FRAME, 0, IHS_BufferPointer(data), data->size);
+    return recorder->audio->submit(session, data, recorder->audio_context);
+}
+
+static void audio_stop(IHS_Session *session, void *context) {
+    es_recorder_t *recorder = context;
+    write_record(recorder, ES_RECORD_AUDIO_STOP, 0, NULL, 0);
+    recorder->audio->stop(session, recorder->audio_context);
+}
+
+static void write_record(es_recorder_t *recorder, es_record_type_t type, uint32_t flags, const void *payload,
+                         size_t size) {
+    static const uint8_t padding[ES_RECORD_ALIGN] = {0};
+    es_record_header_t header = {
+            .type = type,
+            .flags = flags,
+            .size = (uint32_t) size,
+    };
+    size_t padding_size = (ES_RECORD_ALIGN - size % ES_RECORD_ALIGN) % ES_RECORD_ALIGN;
+    pthread_mutex_lock(&recorder->lock);
+    if (recorder->failed) {
+        pthread_mutex_unlock(&recorder->lock);
+        return;
+    }
+    header.timestamp_us = ticks_us() - recorder->begin;
+    // Writes are buffered by stdio, so the receive thread only pays for a copy most of the time
+    bool ok = fwrite(&header, sizeof(header), 1, recorder->file) == 1 &&
+              (size == 0 || fwrite(payload, size, 1, recorder->file) == 1) &&
+              (padding_size == 0 || fwrite(padding, padding_size, 1, recorder->file) == 1);
+    if (ok && (type == ES_RECORD_VIDEO_STOP || type == ES_RECORD_AUDIO_STOP)) {
+        ok = fflush(recorder->file) == 0;
+    }
+    if (ok) {
+        recorder->stats.records++;
+        recorder->stats.bytes += sizeof(header) + size + padding_size;
+    } else {
+        // Replay stops at a partial record, nothing after it would be reachable
+        fprintf(stderr, "Recording write failed, stopped recording\n");
+        recorder->failed = true;
+    }
+    pthread_mutex_unlock(&recorder->lock);
+}
+
+static long long ticks_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ihslib.h"
+
+/*
+ * Elementary stream recording. A file header is followed by records, each a fixed header and a payload padded to
+ * ES_RECORD_ALIGN bytes. Everything is host endian and naturally aligned, so a recording can be mapped and read in
+ * place. Records are only ever appended.
+ */
+
+#define ES_RECORD_MAGIC "IHSPLYES"
+#define ES_RECORD_VERSION 1
+#define ES_RECORD_ALIGN 8
+
+typedef enum es_record_type_t {
+    ES_RECORD_VIDEO_START = 1,
+    ES_RECORD_VIDEO_FRAME,
+    ES_RECORD_VIDEO_STOP,
+    ES_RECORD_AUDIO_START,
+    ES_RECORD_AUDIO_FRAME,
+    ES_RECORD_AUDIO_STOP,
+} es_record_type_t;
+
+typedef struct es_file_header_t {
+    char magic[8];
+    uint32_t version;
+    /** Size of this header, records start right after it */
+    uint32_t header_size;
+} es_file_header_t;
+
+typedef struct es_record_header_t {
+    /** es_record_type_t */
+    uint32_t type;
+    /** IHS_StreamVideoFrameFlag of video frames */
+    uint32_t flags;
+    /** Arrival time since recording started */
+    int64_t timestamp_us;
+    /** Payload bytes after this header, without padding */
+    uint32_t size;
+    uint32_t reserved;
+} es_record_header_t;
+
+/** Payload of ES_RECORD_VIDEO_START */
+typedef struct es_video_config_t {
+    uint32_t codec;
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved;
+} es_video_config_t;
+
+/** Payload of ES_RECORD_AUDIO_START */
+typedef struct es_audio_config_t {
+    uint32_t codec;
+    uint32_t channels;
+    uint32_t frequency;
+    uint32_t reserved;
+} es_audio_config_t;
+
+typedef struct es_recorder_t es_recorder_t;
+
+/**
+ * Record everything a host sends on the way to another set of callbacks. Arrival times are taken when ihslib calls
+ * in, so wrap the outermost callbacks given to the session.
+ *
+ * @param path Recording to create, an existing file is replaced
+ * @return NULL if the file can't be created
+ */
+es_recorder_t *es_recorder_create(const char *path, const IHS_StreamVideoCallbacks *video, void *video_context,
+                                  const IHS_StreamAudioCallbacks *audio, void *audio_context);
+
+void es_recorder_destroy(es_recorder_t *recorder);
+
+/**
+ * Callbacks to give to ihslib, with the recorder as context.
+ */
+const IHS_StreamVideoCallbacks *es_recorder_video_callbacks();
+
+/**
+ * Callbacks to give to ihslib, with the recorder as context.
+ */
+const IHS_StreamAudioCallbacks *es_recorder_audio_callbacks();
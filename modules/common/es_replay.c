@@ -0,0 +1,275 @@
+#include "es_replay.h"
+#include "es_recorder.h"
+#include "module.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct es_replay_t {
+    const IHS_StreamVideoCallbacks *video;
+    void *video_context;
+    const IHS_StreamAudioCallbacks *audio;
+    void *audio_context;
+    es_replay_finished_fn finished;
+    void *finished_context;
+
+    const uint8_t *data;
+    size_t size;
+    double speed;
+    pthread_t thread;
+    atomic_bool running;
+    /* Wakes the replay thread out of a recorded gap when it's stopped */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool video_started, audio_started;
+
+    struct {
+        uint64_t video_frames;
+        uint64_t audio_frames;
+        uint64_t idr_requests;
+        uint64_t errors;
+        long long late_max_us;
+    } stats;
+};
+
+static void *replay_run(void *arg);
+
+static bool replay_record(es_replay_t *replay, const es_record_header_t *header, const uint8_t *payload);
+
+static void sleep_until(es_replay_t *replay, long long deadline_us);
+
+static long long ticks_us();
+
+es_replay_t *es_replay_start(const char *path, double speed, const IHS_StreamVideoCallbacks *video,
+                             void *video_context, const IHS_StreamAudioCallbacks *audio, void *audio_context,
+                             es_replay_finished_fn finished, void *finished_context) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open recording %s\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(es_file_header_t)) {
+        fprintf(stderr, "Recording %s is too short\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Can't map recording %s\n", path);
+        return NULL;
+    }
+    const es_file_header_t *header = data;
+    if (memcmp(header->magic, ES_RECORD_MAGIC, sizeof(header->magic)) != 0 || header->version != ES_RECORD_VERSION ||
+        header->header_size < sizeof(es_file_header_t) || header->header_size > (size_t) st.st_size) {
+        fprintf(stderr, "%s is not a recording this version can read\n", path);
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    // Read front to back exactly once
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    es_replay_t *replay = calloc(1, sizeof(es_replay_t));
+    replay->video = video;
+    replay->video_context = video_context;
+    replay->audio = audio;
+    replay->audio_context = audio_context;
+    replay->finished = finished;
+    replay->finished_context = finished_context;
+    replay->data = data;
+    replay->size = st.st_size;
+    replay->speed = speed;
+    atomic_init(&replay->running, true);
+    pthread_mutex_init(&replay->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&replay->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&replay->thread, NULL, replay_run, replay) != 0) {
+        pthread_cond_destroy(&replay->wake);
+        pthread_mutex_destroy(&replay->lock);
+        munmap(data, st.st_size);
+        free(replay);
+        return NULL;
+    }
+    printf("Replaying %s, %zu bytes at %.2fx\n", path, replay->size, speed);
+    return replay;
+}
+
+void es_replay_stop(es_replay_t *replay) {
+    pthread_mutex_lock(&replay->lock);
+    atomic_store(&replay->running, false);
+    pthread_cond_signal(&replay->wake);
+    pthread_mutex_unlock(&replay->lock);
+    pthread_join(replay->thread, NULL);
+    pthread_cond_destroy(&replay->wake);
+    pthread_mutex_destroy(&replay->lock);
+    munmap((void *) replay->data, replay->size);
+    free(replay);
+}
+
+static void *replay_run(void *arg) {
+    es_replay_t *replay = arg;
+    const es_file_header_t *file_header = (const es_file_header_t *) replay->data;
+    size_t offset = file_header->header_size;
+    long long begin = ticks_us();
+    while (atomic_load(&replay->running) && replay->size - offset >= sizeof(es_record_header_t)) {
+        const es_record_header_t *header = (const es_record_header_t *) (replay->data + offset);
+        size_t payload_offset = offset + sizeof(es_record_header_t);
+        if (header->size > replay->size - payload_offset) {
+            fprintf(stderr, "Recording truncated at offset %zu\n", offset);
+            break;
+        }
+        if (replay->speed > 0) {
+            long long due = begin + (long long) ((double) header->timestamp_us / replay->speed);
+            long long now = ticks_us();
+            if (due > now) {
+                sleep_until(replay, due);
+            } else if (now - due > replay->stats.late_max_us) {
+                replay->stats.late_max_us = now - due;
+            }
+        }
+        if (!atomic_load(&replay->running) || !replay_record(replay, header, replay->data + payload_offset)) {
+            break;
+        }
+        size_t padded = (header->size + ES_RECORD_ALIGN - 1) / ES_RECORD_ALIGN * ES_RECORD_ALIGN;
+        offset = payload_offset + padded < replay->size ? payload_offset + padded : replay->size;
+    }
+    // Recording may end mid-stream, or replay was cut short
+    if (replay->video_started) {
+        replay->video->stop(NULL, replay->video_context);
+        replay->video_started = false;
+    }
+    if (replay->audio_started) {
+        replay->audio->stop(NULL, replay->audio_context);
+        replay->audio_started = false;
+    }
+    double seconds = (double) (ticks_us() - begin) / 1e6;
+    printf("Replay finished in %.2f s: %llu video frames (%.1f fps), %llu audio frames, %llu IDR requests, "
+           "%llu errors, late max %.3f ms\n", seconds, (unsigned long long) replay->stats.video_frames,
+           seconds > 0 ? (double) replay->stats.video_frames / seconds : 0.0,
+           (unsigned long long) replay->stats.audio_frames, (unsigned long long) replay->stats.idr_requests,
+           (unsigned long long) replay->stats.errors, (double) replay->stats.late_max_us / 1000.0);
+    if (replay->finished != NULL) {
+        replay->finished(replay->finished_context);
+    }
+    return NULL;
+}
+
+/**
+ * @return false if replay can't go on
+ */
+static bool replay_record(es_replay_t *replay, const es_record_header_t *header, const uint8_t *payload) {
+    switch (header->type) {
+        case ES_RECORD_VIDEO_START: {
+            es_video_config_t record;
+            if (header->size < sizeof(record)) {
+                return false;
+            }
+            memcpy(&record, payload, sizeof(record));
+            IHS_StreamVideoConfig config;
+            memset(&config, 0, sizeof(config));
+            config.codec = record.codec;
+            config.width = record.width;
+            config.height = record.height;
+            if (replay->video->start(NULL, &config, replay->video_context) != 0) {
+                fprintf(stderr, "Video module refused recorded stream\n");
+                return false;
+            }
+            replay->video_started = true;
+            return true;
+        }
+        case ES_RECORD_AUDIO_START: {
+            es_audio_config_t record;
+            if (header->size < sizeof(record)) {
+                return false;
+            }
+            memcpy(&record, payload, sizeof(record));
+            IHS_StreamAudioConfig config;
+            memset(&config, 0, sizeof(config));
+            config.codec = record.codec;
+            config.channels = record.channels;
+            config.frequency = record.frequency;
+            if (replay->audio->start(NULL, &config, replay->audio_context) != 0) {
+                fprintf(stderr, "Audio module refused recorded stream\n");
+                return false;
+            }
+            replay->audio_started = true;
+            return true;
+        }
+        case ES_RECORD_VIDEO_FRAME:
+        case ES_RECORD_AUDIO_FRAME: {
+            bool video = header->type == ES_RECORD_VIDEO_FRAME;
+            if (!(video ? replay->video_started : replay->audio_started)) {
+                return true;
+            }
+            IHS_Buffer data;
+            IHS_BufferInit(&data, 0, header->size);
+            IHS_BufferAppendMem(&data, payload, header->size);
+            int ret;
+            if (video) {
+                ret = replay->video->submit(NULL, &data, header->flags, replay->video_context);
+                replay->stats.video_frames++;
+            } else {
+                ret = replay->audio->submit(NULL, &data, replay->audio_context);
+                replay->stats.audio_frames++;
+            }
+            IHS_BufferClear(&data, true);
+            // A recording can't send an IDR on request, the module waits for the next recorded one
+            if (video && ret == DR_NEED_IDR) {
+                replay->stats.idr_requests++;
+            } else if (ret != DR_OK) {
+                replay->stats.errors++;
+            }
+            return true;
+        }
+        case ES_RECORD_VIDEO_STOP:
+            if (replay->video_started) {
+                replay->video->stop(NULL, replay->video_context);
+                replay->video_started = false;
+            }
+            return true;
+        case ES_RECORD_AUDIO_STOP:
+            if (replay->audio_started) {
+                replay->audio->stop(NULL, replay->audio_context);
+                replay->audio_started = false;
+            }
+            return true;
+        default:
+            // Record types from a newer writer
+            return true;
+    }
+}
+
+/**
+ * Gaps in a recording can be minutes long, so stop has to be able to cut them short.
+ */
+static void sleep_until(es_replay_t *replay, long long deadline_us) {
+    struct timespec until = {
+            .tv_sec = deadline_us / 1000000,
+            .tv_nsec = (deadline_us % 1000000) * 1000,
+    };
+    pthread_mutex_lock(&replay->lock);
+    while (atomic_load(&replay->running) &&
+           pthread_cond_timedwait(&replay->wake, &replay->lock, &until) != ETIMEDOUT) {
+    }
+    pthread_mutex_unlock(&replay->lock);
+}
+
+static long long ticks_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
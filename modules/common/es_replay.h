@@ -0,0 +1,24 @@
+#pragma once
+
+#include "ihslib.h"
+
+typedef struct es_replay_t es_replay_t;
+
+typedef void (*es_replay_finished_fn)(void *context);
+
+/**
+ * Feed a recording made by es_recorder into module callbacks, from a thread of its own. Records are submitted at
+ * their original arrival times divided by speed. Callbacks get a NULL session.
+ *
+ * @param speed 1 for the original cadence, 2 for twice as fast, 0 to submit as soon as the previous submit returns
+ * @param finished Called on the replay thread after the last record, may be NULL
+ * @return NULL if the file can't be mapped or isn't a recording
+ */
+es_replay_t *es_replay_start(const char *path, double speed, const IHS_StreamVideoCallbacks *video,
+                             void *video_context, const IHS_StreamAudioCallbacks *audio, void *audio_context,
+                             es_replay_finished_fn finished, void *finished_context);
+
+/**
+ * Stop a replay that may still be running, and release it. Streams left started are stopped.
+ */
+void es_replay_stop(es_replay_t *replay);
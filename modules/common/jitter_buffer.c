@@ -0,0 +1,127 @@
+#include "jitter_buffer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Lateness samples the hold time is computed from, about 2 seconds of 60 fps video */
+#define JITTER_WINDOW 128
+/* Recompute hold time every this many frames */
+#define JITTER_UPDATE_FRAMES 30
+/* Lateness under this is noise of the network stack, not worth any delay */
+#define JITTER_FLOOR_US 2000
+#define DEFAULT_FRAME_INTERVAL_US 16667
+
+struct jitter_buffer_t {
+    long long target_us;
+    bool clock_started;
+    long long clock, interval, last_arrival, last_release;
+    long long lateness[JITTER_WINDOW];
+    int lateness_count;
+    long long delay;
+
+    struct {
+        uint64_t frames;
+        uint64_t smoothed;
+        uint64_t held_us;
+        long long max_delay;
+    } stats;
+};
+
+static void update_delay(jitter_buffer_t *buffer);
+
+jitter_buffer_t *jitter_buffer_create(int target_ms) {
+    jitter_buffer_t *buffer = calloc(1, sizeof(jitter_buffer_t));
+    buffer->target_us = (long long) target_ms * 1000;
+    jitter_buffer_reset(buffer);
+    return buffer;
+}
+
+void jitter_buffer_destroy(jitter_buffer_t *buffer) {
+    free(buffer);
+}
+
+void jitter_buffer_reset(jitter_buffer_t *buffer) {
+    buffer->clock_started = false;
+    buffer->interval = DEFAULT_FRAME_INTERVAL_US;
+    buffer->last_release = 0;
+    buffer->lateness_count = 0;
+    buffer->delay = 0;
+    memset(&buffer->stats, 0, sizeof(buffer->stats));
+}
+
+long long jitter_buffer_schedule(jitter_buffer_t *buffer, long long arrival) {
+    if (!buffer->clock_started) {
+        buffer->clock_started = true;
+        buffer->clock = arrival;
+    } else {
+        long long delta = arrival - buffer->last_arrival;
+        if (delta > 0 && delta < buffer->interval * 4) {
+            buffer->interval += (delta - buffer->interval) / 16;
+        }
+        buffer->clock += buffer->interval;
+        long long lateness = arrival - buffer->clock;
+        if (lateness > buffer->interval * 4 + buffer->target_us || lateness < -buffer->interval * 4) {
+            // Stream paused or host changed pace, start over
+            buffer->clock = arrival;
+            lateness = 0;
+        } else {
+            // Follow the sender slowly, without taking on the jitter
+            buffer->clock += lateness / 16;
+        }
+        buffer->lateness[buffer->lateness_count++ % JITTER_WINDOW] = lateness > 0 ? lateness : 0;
+        if (buffer->lateness_count % JITTER_UPDATE_FRAMES == 0) {
+            update_delay(buffer);
+        }
+    }
+    buffer->last_arrival = arrival;
+
+    // Clean link, pass frames through as they come
+    long long release = buffer->delay > 0 ? buffer->clock + buffer->delay : arrival;
+    if (release < arrival) {
+        release = arrival;
+    }
+    if (release < buffer->last_release) {
+        release = buffer->last_release;
+    }
+    buffer->last_release = release;
+
+    buffer->stats.frames++;
+    if (release > arrival) {
+        buffer->stats.smoothed++;
+        buffer->stats.held_us += release - arrival;
+    }
+    return release;
+}
+
+void jitter_buffer_print_stats(const jitter_buffer_t *buffer) {
+    if (buffer->stats.frames == 0) {
+        return;
+    }
+    printf("Jitter buffer: %llu frames, %llu smoothed, added latency avg %.2f ms, max hold %.2f ms\n",
+           (unsigned long long) buffer->stats.frames, (unsigned long long) buffer->stats.smoothed,
+           (double) buffer->stats.held_us / 1000.0 / (double) buffer->stats.frames,
+           (double) buffer->stats.max_delay / 1000.0);
+}
+
+static int compare_lateness(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void update_delay(jitter_buffer_t *buffer) {
+    int count = buffer->lateness_count < JITTER_WINDOW ? buffer->lateness_count : JITTER_WINDOW;
+    long long sorted[JITTER_WINDOW];
+    memcpy(sorted, buffer->lateness, count * sizeof(long long));
+    qsort(sorted, count, sizeof(long long), compare_lateness);
+    long long p95 = sorted[count * 95 / 100];
+    long long delay = p95 < JITTER_FLOOR_US ? 0 : p95;
+    if (delay > buffer->target_us) {
+        delay = buffer->target_us;
+    }
+    buffer->delay = delay;
+    if (delay > buffer->stats.max_delay) {
+        buffer->stats.max_delay = delay;
+    }
+}
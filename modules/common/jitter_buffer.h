@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+
+typedef struct jitter_buffer_t jitter_buffer_t;
+
+/**
+ * Schedules video frames a short while after they arrive, so arrival jitter doesn't show up as stutter. Hold time
+ * follows the 95th percentile of measured lateness, capped at target_ms, and drops back to zero on a clean link.
+ */
+jitter_buffer_t *jitter_buffer_create(int target_ms);
+
+void jitter_buffer_destroy(jitter_buffer_t *buffer);
+
+void jitter_buffer_reset(jitter_buffer_t *buffer);
+
+/**
+ * @param arrival Arrival time of the frame in microseconds, CLOCK_MONOTONIC
+ * @return Time the frame should be handed to the decoder
+ */
+long long jitter_buffer_schedule(jitter_buffer_t *buffer, long long arrival);
+
+void jitter_buffer_print_stats(const jitter_buffer_t *buffer);
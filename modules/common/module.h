@@ -1,17 +1,138 @@
 #pragma once
 
+#include <stdbool.h>
+
 #include "ihslib.h"
 
+struct SDL_Renderer;
+
+#define DR_OK 0
+#define DR_NEED_IDR 1
+
+/* Name of the ihsplay_module_t every module shared object exports */
+#define IHSPLAY_MODULE_SYMBOL "ihsplay_module"
+
+/* Modules are built with hidden visibility, only their table is exported */
+#define IHSPLAY_MODULE_EXPORT __attribute__((visibility("default")))
+
+/**
+ * Entry points of a decoder module. Optional ones may be NULL.
+ */
 typedef struct ihsplay_module_t {
+    const char *name;
+
+    /**
+     * Whether the module can run on this device. Called right after loading, before init. Missing libraries already
+     * fail the load, so this only checks what can't be linked against, like device nodes or available decoders.
+     */
+    bool (*probe)();
+
+    /** Optional */
+    void (*init)(int argc, char *argv[]);
+
+    /** Optional, called once the window exists */
+    void (*post_init)(int argc, char *argv[]);
+
+    /**
+     * Optional. Bring up decoder and audio sink with likely configs ahead of a stream, on a thread of its own.
+     * Keeps whatever is up already. Stream start waits for it if it's still running, and does the work itself if it
+     * never ran.
+     */
+    void (*prewarm)();
+
+    /** Optional, called before exit. Releases what a pre-warm brought up and no stream took over */
+    void (*deinit)();
+
     const IHS_StreamAudioCallbacks *(*audio)();
 
+    /**
+     * Optional. Receive time of the packet the next audio submit on the calling thread gets, in microseconds of
+     * CLOCK_MONOTONIC. Submit may run well after that when packets queue for a worker thread.
+     */
+    void (*audio_arrival)(long long us);
+
     const IHS_StreamVideoCallbacks *(*video)();
+
+    /** Optional. Like audio_arrival, for the next video submit */
+    void (*video_arrival)(long long us);
+
+    /** Optional */
+    void (*suspend)();
+
+    /** Optional */
+    void (*resume)();
+
+    /** Optional, for modules presenting through SDL */
+    bool (*video_update)(struct SDL_Renderer *renderer);
+
+    /** Optional, for modules presenting through SDL */
+    void (*video_draw)(struct SDL_Renderer *renderer);
+
+    /** Optional, for modules presenting through SDL */
+    void (*video_presented)();
 } ihsplay_module_t;
 
-void module_init(int argc, char *argv[]);
+/*
+ * The functions below are implemented by the app, and forward to the module picked by module_init().
+ */
+
+/**
+ * Load the first module that passes its probe, in priority order, and initialize it. IHSPLAY_MODULE picks a module
+ * by name instead, IHSPLAY_MODULE_DIR overrides where they are looked up.
+ *
+ * @return false if no module could be loaded
+ */
+bool module_init(int argc, char *argv[]);
 
 void module_post_init(int argc, char *argv[]);
 
+/**
+ * Run the module's pre-warm in the background, unless one is running already. IHSPLAY_PREWARM=startup also does it
+ * at app start, not only when a session is requested, and IHSPLAY_PREWARM=off disables it.
+ *
+ * @param startup Called at app start, rather than on a session request
+ */
+void module_prewarm(bool startup);
+
+/**
+ * Wait for a running pre-warm, then release the module.
+ */
+void module_deinit();
+
 const IHS_StreamAudioCallbacks *module_audio_callbacks();
 
-const IHS_StreamVideoCallbacks *module_video_callbacks();
\ No newline at end of file
+const IHS_StreamVideoCallbacks *module_video_callbacks();
+
+void module_audio_arrival(long long us);
+
+void module_video_arrival(long long us);
+
+/**
+ * Release the media pipeline (decoder, renderer, audio sink) while the session stays alive.
+ * Frames submitted while suspended are dropped.
+ */
+void module_suspend();
+
+/**
+ * Reopen the media pipeline released by module_suspend(). The next frame submitted after resume requests an IDR
+ * if it's not a key frame.
+ */
+void module_resume();
+
+/**
+ * Take the newest decoded frame for presentation. Called on the main thread every loop iteration.
+ * Modules presenting on a hardware plane have nothing to do here.
+ *
+ * @return true if the screen needs to be redrawn
+ */
+bool module_video_update(struct SDL_Renderer *renderer);
+
+/**
+ * Draw the current video frame. Called on the main thread before UI is composited on top of it.
+ */
+void module_video_draw(struct SDL_Renderer *renderer);
+
+/**
+ * Frame drawn by module_video_draw() is now on screen. Called on the main thread right after the renderer presents.
+ */
+void module_video_presented();
@@ -0,0 +1,154 @@
+#include "param_cache.h"
+#include "annexb.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SEI_PAYLOAD_RECOVERY_POINT 6
+
+static bool has_recovery_point(const uint8_t *sei, size_t size, size_t header_size);
+
+static int set_of(IHS_StreamVideoCodec codec, uint8_t type);
+
+void param_cache_init(param_cache_t *cache, IHS_StreamVideoCodec codec) {
+    memset(cache, 0, sizeof(param_cache_t));
+    cache->codec = codec;
+}
+
+bool param_cache_update(param_cache_t *cache, const uint8_t *data, size_t size) {
+    bool has_sps = false;
+    bool hevc = cache->codec == IHS_StreamVideoCodecHEVC;
+    cache->recovery_point = false;
+    if (!hevc && cache->codec != IHS_StreamVideoCodecH264) {
+        return false;
+    }
+    for (size_t offset = annexb_next(data, size, 0); offset < size; offset = annexb_next(data, size, offset)) {
+        uint8_t type = annexb_nal_type(cache->codec, data[offset]);
+        if (annexb_is_slice(cache->codec, type)) {
+            break;
+        }
+        int set = set_of(cache->codec, type);
+        if (set >= 0) {
+            param_cache_store(cache, set, data + offset, annexb_unit_size(data, size, offset));
+            cache->stats.updates++;
+            has_sps |= set == PARAM_SET_SPS;
+        } else if (!cache->recovery_point && type == (hevc ? NAL_TYPE_HEVC_PREFIX_SEI : NAL_TYPE_H264_SEI)) {
+            cache->recovery_point = has_recovery_point(data + offset, annexb_unit_size(data, size, offset),
+                                                       hevc ? 2 : 1);
+            cache->recovery_points |= cache->recovery_point;
+        }
+    }
+    return has_sps;
+}
+
+void param_cache_store(param_cache_t *cache, param_set_t set, const uint8_t *nal, size_t size) {
+    if (size == 0 || size > PARAM_CACHE_MAX_SET_SIZE) {
+        return;
+    }
+    uint8_t *dst = cache->sets[set].data;
+    dst[0] = dst[1] = dst[2] = 0;
+    dst[3] = 1;
+    memcpy(dst + 4, nal, size);
+    cache->sets[set].size = 4 + size;
+}
+
+bool param_cache_ready(const param_cache_t *cache) {
+    if (cache->codec == IHS_StreamVideoCodecHEVC && cache->sets[PARAM_SET_VPS].size == 0) {
+        return false;
+    }
+    return cache->sets[PARAM_SET_SPS].size > 0 && cache->sets[PARAM_SET_PPS].size > 0;
+}
+
+bool param_cache_can_resume(const param_cache_t *cache) {
+    return cache->recovery_point && param_cache_ready(cache);
+}
+
+size_t param_cache_size(const param_cache_t *cache) {
+    if (!param_cache_ready(cache)) {
+        return 0;
+    }
+    size_t size = 0;
+    for (int i = 0; i < PARAM_SET_COUNT; i++) {
+        size += cache->sets[i].size;
+    }
+    return size;
+}
+
+size_t param_cache_write(param_cache_t *cache, uint8_t *dst, size_t capacity) {
+    size_t size = param_cache_size(cache);
+    if (size == 0 || size > capacity) {
+        return 0;
+    }
+    size_t written = 0;
+    for (int i = 0; i < PARAM_SET_COUNT; i++) {
+        memcpy(dst + written, cache->sets[i].data, cache->sets[i].size);
+        written += cache->sets[i].size;
+    }
+    cache->stats.injections++;
+    return written;
+}
+
+void param_cache_print_stats(const param_cache_t *cache) {
+    if (cache->stats.updates == 0) {
+        return;
+    }
+    printf("Parameter sets: %llu cached, %llu injected, %llu IDR requests avoided%s\n",
+           (unsigned long long) cache->stats.updates, (unsigned long long) cache->stats.injections,
+           (unsigned long long) cache->stats.idr_avoided, cache->recovery_points ? ", stream has recovery points" : "");
+}
+
+/**
+ * Walk SEI messages. Sizes are read from the escaped payload, which is only off when a message contains 00 00 03,
+ * and then only for the messages after it.
+ */
+static bool has_recovery_point(const uint8_t *sei, size_t size, size_t header_size) {
+    size_t pos = header_size;
+    // Stop at rbsp_trailing_bits
+    while (pos < size && sei[pos] != 0x80) {
+        unsigned int type = 0, payload_size = 0;
+        while (pos < size && sei[pos] == 0xFF) {
+            type += 255;
+            pos++;
+        }
+        if (pos >= size) {
+            return false;
+        }
+        type += sei[pos++];
+        while (pos < size && sei[pos] == 0xFF) {
+            payload_size += 255;
+            pos++;
+        }
+        if (pos >= size) {
+            return false;
+        }
+        payload_size += sei[pos++];
+        if (type == SEI_PAYLOAD_RECOVERY_POINT) {
+            return true;
+        }
+        pos += payload_size;
+    }
+    return false;
+}
+
+static int set_of(IHS_StreamVideoCodec codec, uint8_t type) {
+    if (codec == IHS_StreamVideoCodecHEVC) {
+        switch (type) {
+            case NAL_TYPE_HEVC_VPS:
+                return PARAM_SET_VPS;
+            case NAL_TYPE_HEVC_SPS:
+                return PARAM_SET_SPS;
+            case NAL_TYPE_HEVC_PPS:
+                return PARAM_SET_PPS;
+            default:
+                return -1;
+        }
+    }
+    switch (type) {
+        case NAL_TYPE_H264_SPS:
+            return PARAM_SET_SPS;
+        case NAL_TYPE_H264_PPS:
+            return PARAM_SET_PPS;
+        default:
+            return -1;
+    }
+}
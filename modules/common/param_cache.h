@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ihslib.h"
+
+#define PARAM_CACHE_MAX_SET_SIZE 1024
+
+typedef enum param_set_t {
+    PARAM_SET_VPS,
+    PARAM_SET_SPS,
+    PARAM_SET_PPS,
+    PARAM_SET_COUNT,
+} param_set_t;
+
+/**
+ * Most recent parameter sets of a stream, to hand to a decoder that was just opened or reset.
+ *
+ * Parameter sets don't bring back reference frames, so a fresh decoder still has to start from a key frame, unless
+ * it starts on a frame whose recovery point SEI says the stream refreshes itself from there.
+ */
+typedef struct param_cache_t {
+    IHS_StreamVideoCodec codec;
+    struct {
+        /** NAL unit with its 4 byte start code */
+        uint8_t data[4 + PARAM_CACHE_MAX_SET_SIZE];
+        size_t size;
+    } sets[PARAM_SET_COUNT];
+    /** Stream carried recovery point SEI at some point, for stats only */
+    bool recovery_points;
+    /** Last frame given to param_cache_update carries recovery point SEI, so decoding can begin on it */
+    bool recovery_point;
+
+    struct {
+        uint64_t updates;
+        uint64_t injections;
+        uint64_t idr_avoided;
+    } stats;
+} param_cache_t;
+
+void param_cache_init(param_cache_t *cache, IHS_StreamVideoCodec codec);
+
+/**
+ * Remember parameter sets and recovery point SEI found before the first slice of a frame.
+ *
+ * @return true if the frame carries its own SPS
+ */
+bool param_cache_update(param_cache_t *cache, const uint8_t *data, size_t size);
+
+/**
+ * Replace a cached set, e.g. with the rewritten SPS a decoder was actually given.
+ *
+ * @param nal NAL unit without start code
+ */
+void param_cache_store(param_cache_t *cache, param_set_t set, const uint8_t *nal, size_t size);
+
+/**
+ * Whether cached sets are enough to configure a fresh decoder.
+ */
+bool param_cache_ready(const param_cache_t *cache);
+
+/**
+ * Whether a fresh decoder given the cached sets can start on the last updated frame, so no IDR is needed.
+ */
+bool param_cache_can_resume(const param_cache_t *cache);
+
+/**
+ * @return Bytes param_cache_write will write
+ */
+size_t param_cache_size(const param_cache_t *cache);
+
+/**
+ * Write cached sets in VPS, SPS, PPS order, each with a start code.
+ *
+ * @return Bytes written, 0 if nothing is cached or they don't fit
+ */
+size_t param_cache_write(param_cache_t *cache, uint8_t *dst, size_t capacity);
+
+void param_cache_print_stats(const param_cache_t *cache);
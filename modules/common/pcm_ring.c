@@ -0,0 +1,73 @@
+#include "pcm_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool pcm_ring_init(pcm_ring_t *ring, size_t capacity, size_t channels) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring->samples = calloc(size * channels, sizeof(int16_t));
+    if (ring->samples == NULL) {
+        return false;
+    }
+    ring->channels = channels;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return true;
+}
+
+void pcm_ring_deinit(pcm_ring_t *ring) {
+    free(ring->samples);
+    ring->samples = NULL;
+}
+
+size_t pcm_ring_capacity(const pcm_ring_t *ring) {
+    return ring->mask + 1;
+}
+
+size_t pcm_ring_fill(pcm_ring_t *ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return tail - head;
+}
+
+size_t pcm_ring_write(pcm_ring_t *ring, const int16_t *pcm, size_t frames) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t space = pcm_ring_capacity(ring) - (tail - head);
+    if (frames > space) {
+        frames = space;
+    }
+    size_t offset = tail & ring->mask;
+    size_t first = pcm_ring_capacity(ring) - offset;
+    if (first > frames) {
+        first = frames;
+    }
+    size_t frame_bytes = ring->channels * sizeof(int16_t);
+    memcpy(ring->samples + offset * ring->channels, pcm, first * frame_bytes);
+    memcpy(ring->samples, pcm + first * ring->channels, (frames - first) * frame_bytes);
+    // Samples must be visible before the consumer sees the new tail
+    atomic_store_explicit(&ring->tail, tail + frames, memory_order_release);
+    return frames;
+}
+
+size_t pcm_ring_peek(pcm_ring_t *ring, const int16_t **pcm) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t offset = head & ring->mask;
+    size_t frames = tail - head;
+    if (frames > pcm_ring_capacity(ring) - offset) {
+        frames = pcm_ring_capacity(ring) - offset;
+    }
+    *pcm = ring->samples + offset * ring->channels;
+    return frames;
+}
+
+void pcm_ring_consume(pcm_ring_t *ring, size_t frames) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    // Frames may be overwritten by the producer once head moves past them
+    atomic_store_explicit(&ring->head, head + frames, memory_order_release);
+}
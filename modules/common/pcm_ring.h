@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * Lock-free ring of interleaved 16 bit PCM frames, with exactly one producer thread and one consumer thread.
+ */
+typedef struct pcm_ring_t {
+    int16_t *samples;
+    size_t channels;
+    size_t mask;
+    /* Frames read so far, written by consumer only */
+    _Alignas(64) atomic_size_t head;
+    /* Frames written so far, written by producer only */
+    _Alignas(64) atomic_size_t tail;
+} pcm_ring_t;
+
+/**
+ * @param capacity Frames, rounded up to a power of two
+ */
+bool pcm_ring_init(pcm_ring_t *ring, size_t capacity, size_t channels);
+
+void pcm_ring_deinit(pcm_ring_t *ring);
+
+size_t pcm_ring_capacity(const pcm_ring_t *ring);
+
+/**
+ * Frames in the ring. Exact on either side, but may be outdated by the time the other side reads it.
+ */
+size_t pcm_ring_fill(pcm_ring_t *ring);
+
+/**
+ * Producer only. Copies as many frames as fit.
+ *
+ * @return Frames written, less than frames if the ring is full
+ */
+size_t pcm_ring_write(pcm_ring_t *ring, const int16_t *pcm, size_t frames);
+
+/**
+ * Consumer only. Frames readable in one piece, up to the end of the ring storage.
+ *
+ * @param pcm Set to the oldest frame
+ */
+size_t pcm_ring_peek(pcm_ring_t *ring, const int16_t **pcm);
+
+/**
+ * Consumer only. Release frames returned by pcm_ring_peek.
+ */
+void pcm_ring_consume(pcm_ring_t *ring, size_t frames);
@@ -0,0 +1,906 @@
+#include "sps_parser.h"
+#include "annexb.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * MSB-first bit reader over an RBSP (emulation prevention bytes already removed). Up to 64 bits are kept in
+ * a cache register, so fixed length reads are a shift and exp-Golomb codes are a single count-leading-zeros.
+ */
+typedef struct bitstream_t {
+    const uint8_t *data;
+    size_t size;
+    /** Next byte to load into the cache */
+    size_t next;
+    /** Unread bits, left aligned. Bits below the valid count are either zero or the correct upcoming bits */
+    uint64_t cache;
+    uint32_t bits;
+    /** Set once a read runs past the end of data, all further reads fail */
+    bool overrun;
+} bitstream_t;
+
+#define EXTENDED_SAR 255
+
+/** Parameter sets are tiny, anything bigger is truncated and will fail to parse */
+#define SPS_MAX_RBSP_SIZE 1024
+#define RBSP_BLOCK_SIZE 16
+#define MAX_SIZE_IN_MBS 1024
+
+static bool parse_vui_parameters(bitstream_t *buf, sps_info_t *info);
+
+static bool skip_hrd_parameters(bitstream_t *buf);
+
+static int parse_profile_info(bitstream_t *buf);
+
+static bool apply_crop(uint32_t *size, uint32_t first_offset, uint32_t second_offset, uint32_t unit);
+
+/**
+ * Copy NAL payload to RBSP, removing emulation prevention bytes and stopping at the next start code.
+ * Bytes are classified on the escaped input only (00 00 03 is always an escape, 00 00 0[0-2] always ends the NAL),
+ * so whole blocks can be tested without carrying state, and the compiler vectorizes the test.
+ */
+static size_t rbsp_unescape(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity, size_t *consumed) {
+    size_t in = 0, out = 0;
+    while (in < size && out < capacity) {
+        if (in >= 2 && in + RBSP_BLOCK_SIZE <= size && out + RBSP_BLOCK_SIZE <= capacity) {
+            uint8_t special = 0;
+            for (int i = 0; i < RBSP_BLOCK_SIZE; i++) {
+                const uint8_t *p = src + in + i;
+                special |= (uint8_t) (((p[-2] | p[-1]) == 0) & (p[0] <= 3));
+            }
+            if (!special) {
+                memcpy(dst + out, src + in, RBSP_BLOCK_SIZE);
+                in += RBSP_BLOCK_SIZE;
+                out += RBSP_BLOCK_SIZE;
+                continue;
+            }
+        }
+        const uint8_t *p = src + in;
+        if (in >= 2 && p[-2] == 0 && p[-1] == 0 && p[0] <= 3) {
+            if (p[0] != 3) {
+                // Start code or trailing zero bytes, end of this NAL. The two zeroes before aren't part of it
+                in -= 2;
+                out -= 2;
+                break;
+            }
+            in++;
+            continue;
+        }
+        dst[out++] = src[in++];
+    }
+    *consumed = in;
+    return out;
+}
+
+static void bitstream_init(bitstream_t *buf, const uint8_t *data, size_t size) {
+    buf->data = data;
+    buf->size = size;
+    buf->next = 0;
+    buf->cache = 0;
+    buf->bits = 0;
+    buf->overrun = false;
+}
+
+/**
+ * Top up the cache to at least 57 bits, or as much as is left.
+ */
+static inline void bitstream_refill(bitstream_t *buf) {
+    if (buf->next + 8 <= buf->size) {
+        const uint8_t *p = buf->data + buf->next;
+        uint64_t word = (uint64_t) p[0] << 56 | (uint64_t) p[1] << 48 | (uint64_t) p[2] << 40 |
+                        (uint64_t) p[3] << 32 | (uint64_t) p[4] << 24 | (uint64_t) p[5] << 16 |
+                        (uint64_t) p[6] << 8 | (uint64_t) p[7];
+        // Bits already in the cache are ORed with identical values
+        buf->cache |= word >> buf->bits;
+        uint32_t bytes = (63 - buf->bits) >> 3;
+        buf->next += bytes;
+        buf->bits += bytes * 8;
+        return;
+    }
+    while (buf->bits <= 56 && buf->next < buf->size) {
+        buf->cache |= (uint64_t) buf->data[buf->next++] << (56 - buf->bits);
+        buf->bits += 8;
+    }
+}
+
+/**
+ * @return Number of bits read so far
+ */
+static inline uint32_t bitstream_tell(const bitstream_t *buf) {
+    return (uint32_t) (buf->next * 8 - buf->bits);
+}
+
+static inline void bitstream_consume(bitstream_t *buf, uint32_t size) {
+    buf->cache = size < 64 ? buf->cache << size : 0;
+    buf->bits -= size;
+}
+
+static bool bitstream_read_bits(bitstream_t *buf, uint32_t size, uint32_t *value) {
+    if (size > 32) return false;
+    if (size == 0) {
+        *value = 0;
+        return !buf->overrun;
+    }
+    if (buf->bits < size) {
+        bitstream_refill(buf);
+        if (buf->bits < size) {
+            buf->overrun = true;
+        }
+    }
+    if (buf->overrun) {
+        *value = 0;
+        return false;
+    }
+    *value = (uint32_t) (buf->cache >> (64 - size));
+    bitstream_consume(buf, size);
+    return true;
+}
+
+static bool bitstream_skip_bits(bitstream_t *buf, uint32_t size) {
+    uint32_t tmp;
+    for (; size > 32; size -= 32) {
+        if (!bitstream_read_bits(buf, 32, &tmp)) return false;
+    }
+    return bitstream_read_bits(buf, size, &tmp);
+}
+
+static inline bool bitstream_read8(bitstream_t *buf, uint8_t *value) {
+    uint32_t tmp;
+    // Failed reads yield 0, so unchecked flags stay well defined
+    bool ok = bitstream_read_bits(buf, 8, &tmp);
+    *value = tmp;
+    return ok;
+}
+
+static inline bool bitstream_read1(bitstream_t *buf, bool *value) {
+    uint32_t tmp;
+    // Failed reads yield 0, so unchecked flags stay well defined
+    bool ok = bitstream_read_bits(buf, 1, &tmp);
+    *value = tmp;
+    return ok;
+}
+
+static bool bitstream_read_ueg(bitstream_t *buf, uint32_t *value) {
+    *value = 0;
+    if (buf->overrun) return false;
+    bitstream_refill(buf);
+    uint32_t leading_zeroes = buf->cache != 0 ? (uint32_t) __builtin_clzll(buf->cache) : 64;
+    if (leading_zeroes > 31) {
+        // Doesn't fit in 32 bits, or ran out of data
+        buf->overrun = true;
+        return false;
+    }
+    uint32_t length = leading_zeroes * 2 + 1;
+    if (length <= buf->bits) {
+        *value = (uint32_t) ((buf->cache >> (64 - length)) - 1);
+        bitstream_consume(buf, length);
+        return true;
+    }
+    // Code is longer than what the cache holds, only happens for huge values
+    uint32_t tmp;
+    if (!bitstream_skip_bits(buf, leading_zeroes)) return false;
+    if (!bitstream_read_bits(buf, leading_zeroes + 1, &tmp)) return false;
+    *value = tmp - 1;
+    return true;
+}
+
+static bool bitstream_read_eg(bitstream_t *buf, int32_t *value) {
+    uint32_t tmp;
+    if (!bitstream_read_ueg(buf, &tmp)) {
+        return false;
+    }
+    if (tmp & 0x01) {
+        *value = (int32_t) (tmp + 1) / 2;
+    } else {
+        *value = (int32_t) -(tmp / 2);
+    }
+    return true;
+}
+
+static bool bitstream_skip_scaling_list(bitstream_t *buf, uint8_t count) {
+    uint32_t lastScale = 8, nextScale = 8;
+    int32_t deltaScale;
+    for (uint8_t j = 0; j < count; j++) {
+        if (nextScale != 0) {
+            if (!bitstream_read_eg(buf, &deltaScale)) return false;
+            nextScale = (lastScale + deltaScale + 256) % 256;
+        }
+        lastScale = (nextScale == 0 ? lastScale : nextScale);
+    }
+    return true;
+}
+
+static void sps_info_init(sps_info_t *info) {
+    memset(info, 0, sizeof(*info));
+    info->chroma_format_idc = 1;
+    info->bit_depth_luma = info->bit_depth_chroma = 8;
+    info->colour_primaries = info->transfer_characteristics = info->matrix_coefficients = SPS_COLOUR_UNSPECIFIED;
+}
+
+static void reduce_rational(uint32_t *num, uint32_t *den) {
+    uint32_t a = *num, b = *den;
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    *num /= a;
+    *den /= a;
+}
+
+/**
+ * MaxDpbMbs from table A-1
+ */
+static uint32_t h264_max_dpb_mbs(uint8_t level_idc) {
+    switch (level_idc) {
+        case 9:
+        case 10:
+            return 396;
+        case 11:
+            return 900;
+        case 12:
+        case 13:
+        case 20:
+            return 2376;
+        case 21:
+            return 4752;
+        case 22:
+        case 30:
+            return 8100;
+        case 31:
+            return 18000;
+        case 32:
+            return 20480;
+        case 40:
+        case 41:
+            return 32768;
+        case 42:
+            return 34816;
+        case 50:
+            return 110400;
+        case 51:
+        case 52:
+            return 184320;
+        default:
+            return 696320;
+    }
+}
+
+bool sps_parse_h264(const unsigned char *data, size_t size, sps_info_t *info) {
+    uint8_t subwc[] = {1, 2, 2, 1};
+    uint8_t subhc[] = {1, 2, 1, 1};
+
+    if (size < 1 || (data[0] & 0x1F) != NAL_TYPE_H264_SPS) {
+        return false;
+    }
+
+    uint8_t rbsp[SPS_MAX_RBSP_SIZE];
+    bitstream_t buf;
+    size_t nal_size;
+    size_t rbsp_size = rbsp_unescape(data, size, rbsp, sizeof(rbsp), &nal_size);
+    bitstream_init(&buf, rbsp, rbsp_size);
+    sps_info_init(info);
+    info->nal_size = nal_size;
+
+    uint32_t chroma_format_idc = 1;
+
+    uint32_t width, height;
+
+    bitstream_skip_bits(&buf, 8);
+    uint8_t profile_idc;
+    bitstream_read8(&buf, &profile_idc);
+    // constraint_set[0-5]_flag
+    bitstream_skip_bits(&buf, 6);
+
+    /* skip reserved_zero_2bits */
+    if (!bitstream_skip_bits(&buf, 2))
+        return false;
+
+    uint8_t level_idc;
+    bitstream_read8(&buf, &level_idc);
+
+    uint32_t tmp;
+    // id
+    bitstream_read_ueg(&buf, &tmp);
+
+    uint32_t bit_depth_luma_minus8 = 0, bit_depth_chroma_minus8 = 0;
+    if (profile_idc == 100 || profile_idc == 110 ||
+        profile_idc == 122 || profile_idc == 244 || profile_idc == 44 ||
+        profile_idc == 83 || profile_idc == 86 || profile_idc == 118 ||
+        profile_idc == 128 || profile_idc == 138 || profile_idc == 139 ||
+        profile_idc == 134 || profile_idc == 135) {
+        if (!bitstream_read_ueg(&buf, &chroma_format_idc)) return false;
+        if (chroma_format_idc > 3) return false;
+        if (chroma_format_idc == 3) {
+            // separate_colour_plane_flag
+            bitstream_skip_bits(&buf, 1);
+        }
+
+        bitstream_read_ueg(&buf, &bit_depth_luma_minus8);
+        bitstream_read_ueg(&buf, &bit_depth_chroma_minus8);
+        // qpprime_y_zero_transform_bypass_flag
+        bitstream_skip_bits(&buf, 1);
+
+        bool scaling_matrix_present_flag;
+        bitstream_read1(&buf, &scaling_matrix_present_flag);
+        if (scaling_matrix_present_flag) {
+            for (int i = 0; i < ((chroma_format_idc != 3) ? 8 : 12); i++) {
+                bool scaling_list_present_flag;
+                bitstream_read1(&buf, &scaling_list_present_flag);
+                if (scaling_list_present_flag) {
+                    bitstream_skip_scaling_list(&buf, i < 6 ? 16 : 64);
+                }
+            }
+        }
+    }
+    if (bit_depth_luma_minus8 > 6 || bit_depth_chroma_minus8 > 6) return false;
+
+    // log2_max_frame_num_minus4
+    bitstream_read_ueg(&buf, &tmp);
+
+    uint32_t pic_order_cnt_type;
+    bitstream_read_ueg(&buf, &pic_order_cnt_type);
+    if (pic_order_cnt_type == 0) {
+        // log2_max_pic_order_cnt_lsb_minus4
+        bitstream_read_ueg(&buf, &tmp);
+    } else if (pic_order_cnt_type == 1) {
+        // delta_pic_order_always_zero_flag
+        bitstream_skip_bits(&buf, 1);
+        // offset_for_non_ref_pic
+        bitstream_read_eg(&buf, (int32_t *) (&tmp));
+        // offset_for_top_to_bottom_field
+        bitstream_read_eg(&buf, (int32_t *) (&tmp));
+        uint32_t num_ref_frames_in_pic_order_cnt_cycle;
+        bitstream_read_ueg(&buf, &num_ref_frames_in_pic_order_cnt_cycle);
+
+        for (int i = 0; i < num_ref_frames_in_pic_order_cnt_cycle && !buf.overrun; i++) {
+            // offset_for_ref_frame[i]
+            bitstream_read_eg(&buf, (int32_t *) (&tmp));
+        }
+    }
+
+    uint32_t max_num_ref_frames;
+    bitstream_read_ueg(&buf, &max_num_ref_frames);
+    if (max_num_ref_frames > 16) return false;
+    // gaps_in_frame_num_value_allowed_flag
+    bitstream_skip_bits(&buf, 1);
+    uint32_t pic_width_in_mbs_minus1;
+    if (!bitstream_read_ueg(&buf, &pic_width_in_mbs_minus1)) return false;
+    uint32_t pic_height_in_map_units_minus1;
+    if (!bitstream_read_ueg(&buf, &pic_height_in_map_units_minus1)) return false;
+    if (pic_width_in_mbs_minus1 >= MAX_SIZE_IN_MBS || pic_height_in_map_units_minus1 >= MAX_SIZE_IN_MBS) return false;
+
+    bool frame_mbs_only_flag = 0;
+    bitstream_read1(&buf, &frame_mbs_only_flag);
+
+    if (!frame_mbs_only_flag) {
+        // mb_adaptive_frame_field_flag
+        bitstream_skip_bits(&buf, 1);
+    }
+
+    // direct_8x8_inference_flag
+    bitstream_skip_bits(&buf, 1);
+    bool frame_cropping_flag;
+    bitstream_read1(&buf, &frame_cropping_flag);
+    uint32_t frame_crop_left_offset = 0, frame_crop_right_offset = 0, frame_crop_top_offset = 0,
+            frame_crop_bottom_offset = 0;
+    if (frame_cropping_flag) {
+        bitstream_read_ueg(&buf, &frame_crop_left_offset);
+        bitstream_read_ueg(&buf, &frame_crop_right_offset);
+        bitstream_read_ueg(&buf, &frame_crop_top_offset);
+        bitstream_read_ueg(&buf, &frame_crop_bottom_offset);
+    }
+
+    info->vui_flag_offset = bitstream_tell(&buf);
+    bool vui_parameters_present_flag = false;
+    bitstream_read1(&buf, &vui_parameters_present_flag);
+    if (vui_parameters_present_flag) {
+        if (!parse_vui_parameters(&buf, info)) return false;
+    }
+    if (buf.overrun) return false;
+
+    /* Calculate width and height */
+    width = (pic_width_in_mbs_minus1 + 1);
+    width *= 16;
+    height = (pic_height_in_map_units_minus1 + 1);
+    height *= 16 * (2 - frame_mbs_only_flag);
+
+    if (frame_cropping_flag) {
+        const uint32_t crop_unit_x = subwc[chroma_format_idc];
+        const uint32_t crop_unit_y = subhc[chroma_format_idc] * (2 - frame_mbs_only_flag);
+
+        if (!apply_crop(&width, frame_crop_left_offset, frame_crop_right_offset, crop_unit_x) ||
+            !apply_crop(&height, frame_crop_top_offset, frame_crop_bottom_offset, crop_unit_y)) {
+            return false;
+        }
+    }
+
+    info->dimension.width = width;
+    info->dimension.height = height;
+    info->profile_idc = profile_idc;
+    info->level_idc = level_idc;
+    info->chroma_format_idc = chroma_format_idc;
+    info->bit_depth_luma = bit_depth_luma_minus8 + 8;
+    info->bit_depth_chroma = bit_depth_chroma_minus8 + 8;
+    info->frame_mbs_only = frame_mbs_only_flag;
+    info->max_num_ref_frames = max_num_ref_frames;
+    if (info->frame_rate_num != 0) {
+        // VUI ticks are per field
+        info->frame_rate_den *= 2;
+        reduce_rational(&info->frame_rate_num, &info->frame_rate_den);
+    }
+    if (!info->reorder_signalled) {
+        // Without bitstream_restriction decoders have to assume the largest DPB the level allows
+        uint32_t frame_mbs = (pic_width_in_mbs_minus1 + 1) * (pic_height_in_map_units_minus1 + 1) *
+                             (2 - frame_mbs_only_flag);
+        uint32_t max_dpb_frames = h264_max_dpb_mbs(level_idc) / frame_mbs;
+        if (max_dpb_frames > 16) {
+            max_dpb_frames = 16;
+        }
+        info->max_dec_frame_buffering = max_dpb_frames;
+        // POC type 2 means output order is decoding order
+        info->max_num_reorder_frames = pic_order_cnt_type == 2 ? 0 : max_dpb_frames;
+    }
+    return true;
+}
+
+bool sps_parse_hevc(const unsigned char *data, size_t size, sps_info_t *info) {
+    uint8_t subwc[] = {1, 2, 2, 1, 1};
+    uint8_t subhc[] = {1, 2, 1, 1, 1};
+
+    uint8_t max_sub_layers_minus1 = 0;
+
+    uint8_t sub_layer_profile_present_flag[6];
+    uint8_t sub_layer_level_present_flag[6];
+    uint32_t tmp;
+
+    if (size < 2 || (data[0] >> 1 & 0x3F) != NAL_TYPE_HEVC_SPS) {
+        return false;
+    }
+
+    uint8_t rbsp[SPS_MAX_RBSP_SIZE];
+    bitstream_t buf;
+    size_t nal_size;
+    size_t rbsp_size = rbsp_unescape(data, size, rbsp, sizeof(rbsp), &nal_size);
+    bitstream_init(&buf, rbsp, rbsp_size);
+    sps_info_init(info);
+    info->nal_size = nal_size;
+    // nal_unit_header
+    bitstream_skip_bits(&buf, 16);
+    // vps_id
+    bitstream_skip_bits(&buf, 4);
+    bitstream_read_bits(&buf, 3, &tmp);
+    max_sub_layers_minus1 = tmp;
+    if (max_sub_layers_minus1 > 6) return false;
+    // temporal_id_nesting_flag
+    bitstream_skip_bits(&buf, 1);
+    {
+        info->profile_idc = parse_profile_info(&buf);
+
+        bitstream_read8(&buf, &info->level_idc);
+        for (int i = 0; i < max_sub_layers_minus1; i++) {
+            uint32_t flg;
+            if (!bitstream_read_bits(&buf, 1, &flg)) {
+                return false;
+            }
+            sub_layer_profile_present_flag[i] = flg;
+            if (!bitstream_read_bits(&buf, 1, &flg)) {
+                return false;
+            }
+            sub_layer_level_present_flag[i] = flg;
+        }
+
+        if (max_sub_layers_minus1 > 0) {
+            for (int i = max_sub_layers_minus1; i < 8; i++) {
+                // skip 2 bits
+                bitstream_skip_bits(&buf, 2);
+            }
+        }
+
+        for (int i = 0; i < max_sub_layers_minus1; i++) {
+            if (sub_layer_profile_present_flag[i]) {
+                parse_profile_info(&buf);
+            }
+
+            if (sub_layer_level_present_flag[i]) {
+                // sub_layer_level_idc[i]
+                bitstream_skip_bits(&buf, 8);
+            }
+        }
+    }
+
+    // id
+    if (!bitstream_read_ueg(&buf, &tmp)) return false;
+
+    uint32_t chroma_format_idc;
+    if (!bitstream_read_ueg(&buf, &chroma_format_idc)) return false;
+    if (chroma_format_idc > 3) return false;
+    if (chroma_format_idc == 3) {
+        // separate_colour_plane_flag:1
+        bitstream_skip_bits(&buf, 1);
+    }
+
+    uint32_t pic_width_in_luma_samples;
+    uint32_t pic_height_in_luma_samples;
+    if (!bitstream_read_ueg(&buf, &pic_width_in_luma_samples)) return false;
+    if (!bitstream_read_ueg(&buf, &pic_height_in_luma_samples)) return false;
+    if (pic_width_in_luma_samples <= 0 || pic_height_in_luma_samples <= 0) return false;
+
+    bool conformance_window_flag = false;
+    bitstream_read1(&buf, &conformance_window_flag);
+    uint32_t conf_win_left_offset = 0, conf_win_right_offset = 0, conf_win_top_offset = 0, conf_win_bottom_offset = 0;
+    if (conformance_window_flag) {
+        bitstream_read_ueg(&buf, &conf_win_left_offset);
+        bitstream_read_ueg(&buf, &conf_win_right_offset);
+        bitstream_read_ueg(&buf, &conf_win_top_offset);
+        bitstream_read_ueg(&buf, &conf_win_bottom_offset);
+    }
+
+    uint32_t bit_depth_luma_minus8, bit_depth_chroma_minus8;
+    bitstream_read_ueg(&buf, &bit_depth_luma_minus8);
+    bitstream_read_ueg(&buf, &bit_depth_chroma_minus8);
+    if (bit_depth_luma_minus8 > 8 || bit_depth_chroma_minus8 > 8) return false;
+    // log2_max_pic_order_cnt_lsb_minus4
+    bitstream_read_ueg(&buf, &tmp);
+
+    // Ordering info of the highest sub-layer applies to the whole stream
+    bool sub_layer_ordering_info_present_flag;
+    bitstream_read1(&buf, &sub_layer_ordering_info_present_flag);
+    uint32_t max_dec_pic_buffering_minus1 = 0, max_num_reorder_pics = 0;
+    for (int i = sub_layer_ordering_info_present_flag ? 0 : max_sub_layers_minus1;
+         i <= max_sub_layers_minus1; i++) {
+        bitstream_read_ueg(&buf, &max_dec_pic_buffering_minus1);
+        bitstream_read_ueg(&buf, &max_num_reorder_pics);
+        // max_latency_increase_plus1
+        bitstream_read_ueg(&buf, &tmp);
+    }
+    if (max_dec_pic_buffering_minus1 > 15 || max_num_reorder_pics > max_dec_pic_buffering_minus1) return false;
+    if (buf.overrun) return false;
+
+    uint32_t width = pic_width_in_luma_samples, height = pic_height_in_luma_samples;
+    if (conformance_window_flag) {
+        const uint8_t crop_unit_x = subwc[chroma_format_idc];
+        const uint8_t crop_unit_y = subhc[chroma_format_idc];
+        if (!apply_crop(&width, conf_win_left_offset, conf_win_right_offset, crop_unit_x) ||
+            !apply_crop(&height, conf_win_top_offset, conf_win_bottom_offset, crop_unit_y)) {
+            return false;
+        }
+    }
+    info->dimension.width = width;
+    info->dimension.height = height;
+    info->chroma_format_idc = chroma_format_idc;
+    info->bit_depth_luma = bit_depth_luma_minus8 + 8;
+    info->bit_depth_chroma = bit_depth_chroma_minus8 + 8;
+    info->max_dec_frame_buffering = max_dec_pic_buffering_minus1 + 1;
+    info->max_num_reorder_frames = max_num_reorder_pics;
+    info->reorder_signalled = true;
+    return true;
+}
+
+typedef struct bitwriter_t {
+    uint8_t *data;
+    size_t capacity;
+    size_t bits;
+    bool overflow;
+} bitwriter_t;
+
+static void bitwriter_put(bitwriter_t *buf, uint32_t size, uint32_t value) {
+    for (int i = (int) size - 1; i >= 0; i--) {
+        if (buf->bits / 8 >= buf->capacity) {
+            buf->overflow = true;
+            return;
+        }
+        if (value >> i & 1) {
+            buf->data[buf->bits / 8] |= (uint8_t) (0x80 >> buf->bits % 8);
+        }
+        buf->bits++;
+    }
+}
+
+static void bitwriter_put_ueg(bitwriter_t *buf, uint32_t value) {
+    uint32_t code = value + 1;
+    uint32_t length = 32 - (uint32_t) __builtin_clz(code);
+    bitwriter_put(buf, length - 1, 0);
+    bitwriter_put(buf, length, code);
+}
+
+size_t sps_rewrite_h264_no_reorder(const unsigned char *data, const sps_info_t *info, unsigned char *out,
+                                   size_t capacity) {
+    if (info->reorder_signalled || info->max_num_reorder_frames != 0) {
+        return 0;
+    }
+    uint8_t rbsp[SPS_MAX_RBSP_SIZE];
+    size_t consumed;
+    size_t rbsp_size = rbsp_unescape(data, info->nal_size, rbsp, sizeof(rbsp), &consumed);
+    // Without VUI it's appended after the last SPS field, otherwise bitstream_restriction is its last field
+    bool has_vui = info->restriction_flag_offset != 0;
+    uint32_t keep = has_vui ? info->restriction_flag_offset : info->vui_flag_offset;
+    if (keep == 0 || keep > rbsp_size * 8) {
+        return 0;
+    }
+
+    uint8_t patched[SPS_MAX_RBSP_SIZE + 16];
+    memset(patched, 0, sizeof(patched));
+    bitwriter_t buf = {patched, sizeof(patched), 0, false};
+    memcpy(patched, rbsp, keep / 8);
+    buf.bits = keep / 8 * 8;
+    if (keep % 8) {
+        bitwriter_put(&buf, keep % 8, rbsp[keep / 8] >> (8 - keep % 8));
+    }
+    if (!has_vui) {
+        // vui_parameters_present_flag, then nothing but bitstream_restriction
+        bitwriter_put(&buf, 1, 1);
+        bitwriter_put(&buf, 8, 0);
+    }
+    // bitstream_restriction_flag, motion_vectors_over_pic_boundaries_flag
+    bitwriter_put(&buf, 2, 3);
+    // max_bytes_per_pic_denom, max_bits_per_mb_denom, log2_max_mv_length_horizontal/vertical: inferred defaults
+    bitwriter_put_ueg(&buf, 2);
+    bitwriter_put_ueg(&buf, 1);
+    bitwriter_put_ueg(&buf, 16);
+    bitwriter_put_ueg(&buf, 16);
+    // max_num_reorder_frames
+    bitwriter_put_ueg(&buf, 0);
+    // max_dec_frame_buffering, can't be less than the references the stream keeps
+    bitwriter_put_ueg(&buf, info->max_num_ref_frames > 0 ? info->max_num_ref_frames : 1);
+    // rbsp_stop_one_bit, then rbsp_alignment_zero_bits
+    bitwriter_put(&buf, 1, 1);
+    if (buf.overflow) {
+        return 0;
+    }
+
+    // Escape back to NAL payload
+    size_t patched_size = (buf.bits + 7) / 8, size = 0;
+    int zeroes = 0;
+    for (size_t i = 0; i < patched_size; i++) {
+        if (zeroes >= 2 && patched[i] <= 3) {
+            if (size >= capacity) return 0;
+            out[size++] = 0x03;
+            zeroes = 0;
+        }
+        if (size >= capacity) return 0;
+        out[size++] = patched[i];
+        zeroes = patched[i] == 0 ? zeroes + 1 : 0;
+    }
+    return size;
+}
+
+/**
+ * Offsets come straight from the bitstream, so a broken SPS can crop more than the whole picture.
+ *
+ * @return false if nothing would be left
+ */
+static bool apply_crop(uint32_t *size, uint32_t first_offset, uint32_t second_offset, uint32_t unit) {
+    uint64_t crop = ((uint64_t) first_offset + second_offset) * unit;
+    if (crop >= *size) {
+        return false;
+    }
+    *size -= (uint32_t) crop;
+    return true;
+}
+
+static bool parse_vui_parameters(bitstream_t *buf, sps_info_t *info) {
+    bool aspect_ratio_info_present_flag = false;
+    bitstream_read1(buf, &aspect_ratio_info_present_flag);
+    if (aspect_ratio_info_present_flag) {
+        uint8_t aspect_ratio_idc;
+        bitstream_read8(buf, &aspect_ratio_idc);
+        if (aspect_ratio_idc == EXTENDED_SAR) {
+            // sar_width
+            bitstream_skip_bits(buf, 16);
+            // sar_height
+            bitstream_skip_bits(buf, 16);
+        }
+    }
+
+    bool overscan_info_present_flag = false;
+    bitstream_read1(buf, &overscan_info_present_flag);
+    if (overscan_info_present_flag) {
+        // overscan_appropriate_flag
+        bitstream_skip_bits(buf, 1);
+    }
+
+    bool video_signal_type_present_flag = false;
+    bitstream_read1(buf, &video_signal_type_present_flag);
+    if (video_signal_type_present_flag) {
+        // video_format
+        bitstream_skip_bits(buf, 3);
+        bitstream_read1(buf, &info->full_range);
+        bool colour_description_present_flag = false;
+        bitstream_read1(buf, &colour_description_present_flag);
+        if (colour_description_present_flag) {
+            bitstream_read8(buf, &info->colour_primaries);
+            bitstream_read8(buf, &info->transfer_characteristics);
+            bitstream_read8(buf, &info->matrix_coefficients);
+        }
+    }
+
+    bool chroma_loc_info_present_flag = false;
+    bitstream_read1(buf, &chroma_loc_info_present_flag);
+    if (chroma_loc_info_present_flag) {
+        bitstream_skip_bits(buf, 5);
+        bitstream_skip_bits(buf, 5);
+    }
+
+    bool timing_info_present_flag = false;
+    bitstream_read1(buf, &timing_info_present_flag);
+    if (timing_info_present_flag) {
+        uint32_t num_units_in_tick, time_scale;
+        bitstream_read_bits(buf, 32, &num_units_in_tick);
+        bitstream_read_bits(buf, 32, &time_scale);
+        // fixed_frame_rate_flag
+        bitstream_skip_bits(buf, 1);
+        if (num_units_in_tick != 0 && time_scale != 0) {
+            info->frame_rate_num = time_scale;
+            info->frame_rate_den = num_units_in_tick;
+        }
+    }
+
+    bool nal_hrd_parameters_present_flag = false;
+    bitstream_read1(buf, &nal_hrd_parameters_present_flag);
+    if (nal_hrd_parameters_present_flag) {
+        if (!skip_hrd_parameters(buf))
+            return false;
+    }
+
+    bool vcl_hrd_parameters_present_flag = false;
+    bitstream_read1(buf, &vcl_hrd_parameters_present_flag);
+    if (vcl_hrd_parameters_present_flag) {
+        if (!skip_hrd_parameters(buf))
+            return false;
+    }
+
+    if (nal_hrd_parameters_present_flag || vcl_hrd_parameters_present_flag) {
+        // low_delay_hrd_flag
+        bitstream_skip_bits(buf, 1);
+    }
+
+    // pic_struct_present_flag
+    bitstream_skip_bits(buf, 1);
+    info->restriction_flag_offset = bitstream_tell(buf);
+    bool bitstream_restriction_flag = false;
+    bitstream_read1(buf, &bitstream_restriction_flag);
+    if (bitstream_restriction_flag) {
+        // motion_vectors_over_pic_boundaries_flag
+        bitstream_skip_bits(buf, 1);
+        uint32_t tmp;
+        // max_bytes_per_pic_denom
+        bitstream_read_ueg(buf, &tmp);
+        // max_bits_per_mb_denom
+        bitstream_read_ueg(buf, &tmp);
+        // log2_max_mv_length_horizontal
+        bitstream_read_ueg(buf, &tmp);
+        // log2_max_mv_length_vertical
+        bitstream_read_ueg(buf, &tmp);
+        uint32_t max_num_reorder_frames, max_dec_frame_buffering;
+        bitstream_read_ueg(buf, &max_num_reorder_frames);
+        bitstream_read_ueg(buf, &max_dec_frame_buffering);
+        if (max_dec_frame_buffering > 16 || max_num_reorder_frames > max_dec_frame_buffering) return false;
+        info->max_num_reorder_frames = max_num_reorder_frames;
+        info->max_dec_frame_buffering = max_dec_frame_buffering;
+        info->reorder_signalled = true;
+    }
+
+    return true;
+}
+
+static bool skip_hrd_parameters(bitstream_t *buf) {
+    uint32_t cpb_cnt_minus1;
+    bitstream_read_ueg(buf, &cpb_cnt_minus1);
+    if (cpb_cnt_minus1 > 31) return false;
+
+    // bit_rate_scale
+    bitstream_skip_bits(buf, 4);
+    // cpb_size_scale
+    bitstream_skip_bits(buf, 4);
+
+    uint32_t tmp;
+
+    for (int sched_sel_idx = 0; sched_sel_idx <= cpb_cnt_minus1; sched_sel_idx++) {
+        // bit_rate_value_minus1[sched_sel_idx]
+        bitstream_read_ueg(buf, &tmp);
+        // cpb_size_value_minus1[sched_sel_idx]
+        bitstream_read_ueg(buf, &tmp);
+        // cbr_flag[sched_sel_idx]
+        bitstream_skip_bits(buf, 1);
+    }
+
+    // initial_cpb_removal_delay_length_minus1
+    bitstream_skip_bits(buf, 5);
+    // cpb_removal_delay_length_minus1
+    bitstream_skip_bits(buf, 5);
+    // dpb_output_delay_length_minus1
+    bitstream_skip_bits(buf, 5);
+    // time_offset_length
+    bitstream_skip_bits(buf, 5);
+    return true;
+}
+
+static int parse_profile_info(bitstream_t *buf) {
+    // profile_space:2
+    bitstream_skip_bits(buf, 2);
+    // tier_flag:1
+    bitstream_skip_bits(buf, 1);
+    uint32_t profile_idc;
+    bitstream_read_bits(buf, 5, &profile_idc);
+
+    for (int i = 0; i < 32; i++) {
+        // profile_compatibility_flag[i]
+        bitstream_skip_bits(buf, 1);
+    }
+    // progressive_source_flag
+    bitstream_skip_bits(buf, 1);
+    // interlaced_source_flag
+    bitstream_skip_bits(buf, 1);
+    // non_packed_constraint_flag
+    bitstream_skip_bits(buf, 1);
+    // frame_only_constraint_flag
+    bitstream_skip_bits(buf, 1);
+
+    bitstream_skip_bits(buf, 44);
+
+    return (int) profile_idc;
+}
+
+static const struct {
+    const char *name;
+    bool hevc;
+    uint16_t width, height;
+    size_t size;
+    const unsigned char *data;
+} benchmark_corpus[] = {
+        {"H.264 Baseline 1280x720", false, 1280, 720, 9, (const unsigned char[]) {
+                0x67, 0x42, 0x00, 0x1f, 0xd9, 0x40, 0x50, 0x05, 0xb9}},
+        {"H.264 Main 2560x1440", false, 2560, 1440, 20, (const unsigned char[]) {
+                0x67, 0x4d, 0x00, 0x32, 0xec, 0xa0, 0x14, 0x00, 0x5a, 0xd0, 0x80, 0x00, 0x00, 0x03, 0x00, 0x80,
+                0x00, 0x00, 0x3c, 0x42}},
+        {"H.264 High 1920x1080", false, 1920, 1080, 26, (const unsigned char[]) {
+                0x67, 0x64, 0x00, 0x2a, 0xac, 0xb2, 0x80, 0xf0, 0x04, 0x4f, 0xcb, 0x08, 0x00, 0x00, 0x03, 0x00,
+                0x08, 0x00, 0x00, 0x03, 0x03, 0xc4, 0x6d, 0x04, 0x42, 0x35}},
+        {"H.264 High 1920x1080 scaling lists", false, 1920, 1080, 71, (const unsigned char[]) {
+                0x67, 0x64, 0x00, 0x2a, 0xad, 0x95, 0xd1, 0x0a, 0xe8, 0x85, 0x74, 0x42, 0x92, 0xba, 0x21, 0x5d,
+                0x10, 0xae, 0x88, 0x52, 0x57, 0x44, 0x2b, 0xa2, 0x15, 0xd1, 0x0a, 0xe8, 0x85, 0x74, 0x42, 0xba,
+                0x21, 0x5d, 0x10, 0xae, 0x88, 0x57, 0x44, 0x2b, 0xa2, 0x15, 0xd1, 0x0a, 0xe8, 0x85, 0x74, 0xb2,
+                0x80, 0xf0, 0x04, 0x4f, 0xcb, 0x35, 0x01, 0x01, 0x01, 0x40, 0x00, 0x00, 0x03, 0x00, 0x40, 0x00,
+                0x00, 0x1e, 0x23, 0x68, 0x22, 0x11, 0xa8}},
+        {"H.264 High 3840x2160", false, 3840, 2160, 31, (const unsigned char[]) {
+                0x67, 0x64, 0x00, 0x33, 0xac, 0xb2, 0x80, 0x78, 0x00, 0x88, 0xfc, 0x4c, 0xdc, 0x04, 0x04, 0x05,
+                0x00, 0x00, 0x03, 0x00, 0x01, 0x00, 0x00, 0x03, 0x00, 0xf0, 0x8d, 0xa0, 0x88, 0x46, 0xe0}},
+        {"H.264 High 1366x768 interlaced", false, 1366, 768, 11, (const unsigned char[]) {
+                0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x56, 0x0c, 0x1c, 0xda}},
+        {"HEVC Main 1920x1080", true, 1920, 1080, 30, (const unsigned char[]) {
+                0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+                0x00, 0x7b, 0xa0, 0x03, 0xc0, 0x80, 0x11, 0x07, 0xcb, 0x96, 0xb9, 0x24, 0xda, 0xc8}},
+        {"HEVC Main 3840x2160", true, 3840, 2160, 30, (const unsigned char[]) {
+                0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+                0x00, 0x7b, 0xa0, 0x01, 0xe0, 0x20, 0x02, 0x1c, 0x59, 0x65, 0x79, 0x24, 0xda, 0xc8}},
+};
+
+static long long benchmark_ticks_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void sps_parser_benchmark() {
+    const int iterations = 100000;
+    printf("SPS parsing, ns per parameter set\n");
+    for (int c = 0; c < sizeof(benchmark_corpus) / sizeof(benchmark_corpus[0]); c++) {
+        sps_info_t info;
+        bool ok = true;
+        long long begin = benchmark_ticks_ns();
+        for (int i = 0; i < iterations; i++) {
+            if (benchmark_corpus[c].hevc) {
+                ok &= sps_parse_hevc(benchmark_corpus[c].data, benchmark_corpus[c].size, &info);
+            } else {
+                ok &= sps_parse_h264(benchmark_corpus[c].data, benchmark_corpus[c].size, &info);
+            }
+        }
+        double ns = (double) (benchmark_ticks_ns() - begin) / iterations;
+        ok &= info.dimension.width == benchmark_corpus[c].width && info.dimension.height == benchmark_corpus[c].height;
+        printf("  %-36s %3d bytes %8.1f ns %s\n", benchmark_corpus[c].name, (int) benchmark_corpus[c].size, ns,
+               ok ? "" : "MISMATCH");
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SPS_COLOUR_UNSPECIFIED 2
+
+typedef struct sps_dimension_t {
+    uint16_t width;
+    uint16_t height;
+} sps_dimension_t;
+
+typedef struct sps_info_t {
+    sps_dimension_t dimension;
+    uint8_t profile_idc;
+    uint8_t level_idc;
+    uint8_t chroma_format_idc;
+    uint8_t bit_depth_luma;
+    uint8_t bit_depth_chroma;
+    /** H.264 only */
+    bool frame_mbs_only;
+    uint8_t max_num_ref_frames;
+    /** Pictures a decoder holds back before output. 0 when output order is decoding order */
+    uint8_t max_num_reorder_frames;
+    /** Decoded picture buffer size in frames */
+    uint8_t max_dec_frame_buffering;
+    /** Whether the two above come from the stream, otherwise they are the worst case the level allows */
+    bool reorder_signalled;
+    /** Frames per second from VUI timing info, 0 if not signalled */
+    uint32_t frame_rate_num, frame_rate_den;
+    bool full_range;
+    /** ITU-T H.273 code points, SPS_COLOUR_UNSPECIFIED if not signalled */
+    uint8_t colour_primaries;
+    uint8_t transfer_characteristics;
+    uint8_t matrix_coefficients;
+    /** Bytes of the NAL unit up to the next start code */
+    size_t nal_size;
+    /** RBSP bit positions of vui_parameters_present_flag and bitstream_restriction_flag (0 without VUI), H.264 only */
+    uint32_t vui_flag_offset, restriction_flag_offset;
+} sps_info_t;
+
+/**
+ * @param data SPS NAL unit, starting from NAL header. Parsing stops at the next start code or after size bytes.
+ */
+bool sps_parse_h264(const unsigned char *data, size_t size, sps_info_t *info);
+
+/**
+ * @param data SPS NAL unit, starting from NAL header. VUI is not parsed, so frame rate and colour are left unknown.
+ */
+bool sps_parse_hevc(const unsigned char *data, size_t size, sps_info_t *info);
+
+/**
+ * Rewrite an H.264 SPS to signal that pictures come out in decoding order, with a DPB only as deep as the references
+ * in use. Decoders that size output delay from bitstream_restriction (like VideoCore) then release every picture
+ * as soon as it's decoded.
+ *
+ * @param data SPS NAL unit that was parsed into info
+ * @return Size of rewritten NAL unit in out, or 0 if the stream reorders pictures, already signals its reordering,
+ *         or out is too small
+ */
+size_t sps_rewrite_h264_no_reorder(const unsigned char *data, const sps_info_t *info, unsigned char *out,
+                                   size_t capacity);
+
+/**
+ * Print parsing cost of a set of representative SPS NAL units.
+ */
+void sps_parser_benchmark();
@@ -0,0 +1,66 @@
+#include "spsc_ring.h"
+
+#include <stdlib.h>
+
+bool spsc_ring_init(spsc_ring_t *ring, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring->slots = calloc(size, sizeof(void *));
+    if (ring->slots == NULL) {
+        return false;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return true;
+}
+
+void spsc_ring_deinit(spsc_ring_t *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+size_t spsc_ring_capacity(const spsc_ring_t *ring) {
+    return ring->mask + 1;
+}
+
+size_t spsc_ring_size(spsc_ring_t *ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return tail - head;
+}
+
+bool spsc_ring_push(spsc_ring_t *ring, void *item) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head > ring->mask) {
+        return false;
+    }
+    ring->slots[tail & ring->mask] = item;
+    // Slot content must be visible before the consumer sees the new tail
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+void *spsc_ring_peek(spsc_ring_t *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail) {
+        return NULL;
+    }
+    return ring->slots[head & ring->mask];
+}
+
+void *spsc_ring_pop(spsc_ring_t *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail) {
+        return NULL;
+    }
+    void *item = ring->slots[head & ring->mask];
+    // Slot may be reused by the producer once head moves past it
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return item;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/**
+ * Lock-free ring of pointers with exactly one producer thread and one consumer thread.
+ */
+typedef struct spsc_ring_t {
+    void **slots;
+    size_t mask;
+    /* Next slot to read, written by consumer only */
+    _Alignas(64) atomic_size_t head;
+    /* Next slot to write, written by producer only */
+    _Alignas(64) atomic_size_t tail;
+} spsc_ring_t;
+
+/**
+ * @param capacity Rounded up to a power of two
+ */
+bool spsc_ring_init(spsc_ring_t *ring, size_t capacity);
+
+void spsc_ring_deinit(spsc_ring_t *ring);
+
+size_t spsc_ring_capacity(const spsc_ring_t *ring);
+
+/**
+ * Number of items in the ring. Exact on either side, but may be outdated by the time the other side reads it.
+ */
+size_t spsc_ring_size(spsc_ring_t *ring);
+
+/**
+ * Producer only.
+ *
+ * @return false if the ring is full
+ */
+bool spsc_ring_push(spsc_ring_t *ring, void *item);
+
+/**
+ * Consumer only. Oldest item, or NULL if the ring is empty.
+ */
+void *spsc_ring_peek(spsc_ring_t *ring);
+
+/**
+ * Consumer only. Remove and return the oldest item, or NULL if the ring is empty.
+ */
+void *spsc_ring_pop(spsc_ring_t *ring);
@@ -0,0 +1,389 @@
+#include "stream_worker.h"
+#include "backpressure.h"
+#include "jitter_buffer.h"
+#include "module.h"
+#include "spsc_ring.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+/* Deep enough for the jitter buffer hold, shallow enough that a slow decoder can't pile up latency */
+#define VIDEO_RING_SIZE 16
+#define AUDIO_RING_SIZE 64
+
+typedef struct stream_packet_t {
+    IHS_Buffer data;
+    IHS_StreamVideoFrameFlag flags;
+    long long enqueued, release;
+} stream_packet_t;
+
+struct stream_worker_t {
+    bool video;
+    union {
+        const IHS_StreamVideoCallbacks *video;
+        const IHS_StreamAudioCallbacks *audio;
+    } callbacks;
+    void *context;
+    void (*arrival)(long long us);
+    IHS_Session *session;
+    jitter_buffer_t *jitter;
+
+    spsc_ring_t ring;
+    /* Counts packets in the ring, so the worker can sleep while it's empty */
+    sem_t available;
+    /* Posted for every packet taken out of the ring, blocking submits wait on it while the ring is full */
+    bool blocking;
+    sem_t space;
+    pthread_t thread;
+    /* Thread exists and has to be joined, owned by the thread calling start and stop */
+    bool started;
+    atomic_bool running;
+    /* Result of the decoder that has to go back to ihslib, e.g. DR_NEED_IDR */
+    atomic_int pending_result;
+
+    /* Receive thread only */
+    backpressure_t backpressure;
+    struct {
+        uint64_t packets;
+        uint64_t overflows;
+        uint64_t occupancy_sum;
+        size_t occupancy_max;
+    } enqueue_stats;
+
+    /* Worker thread only */
+    struct {
+        uint64_t packets;
+        uint64_t latency_us;
+        long long latency_max;
+    } dequeue_stats;
+};
+
+static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context);
+
+static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context);
+
+static void video_stop(IHS_Session *session, void *context);
+
+static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context);
+
+static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context);
+
+static void audio_stop(IHS_Session *session, void *context);
+
+static stream_worker_t *worker_create(bool video, void *context);
+
+static bool worker_start(stream_worker_t *worker, IHS_Session *session);
+
+static void worker_stop(stream_worker_t *worker);
+
+static void worker_print_stats(stream_worker_t *worker);
+
+static bool worker_enqueue(stream_worker_t *worker, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags);
+
+static void *worker_run(void *arg);
+
+static void free_packet(stream_packet_t *packet);
+
+static long long ticks_us();
+
+static const IHS_StreamVideoCallbacks worker_video_callbacks = {
+        .start = video_start,
+        .submit = video_submit,
+        .stop = video_stop,
+};
+
+static const IHS_StreamAudioCallbacks worker_audio_callbacks = {
+        .start = audio_start,
+        .submit = audio_submit,
+        .stop = audio_stop,
+};
+
+stream_worker_t *stream_worker_create_video(const IHS_StreamVideoCallbacks *callbacks, void *context,
+                                            int jitter_target_ms, void (*arrival)(long long us)) {
+    stream_worker_t *worker = worker_create(true, context);
+    worker->callbacks.video = callbacks;
+    worker->arrival = arrival;
+    if (jitter_target_ms > 0) {
+        worker->jitter = jitter_buffer_create(jitter_target_ms);
+    }
+    return worker;
+}
+
+stream_worker_t *stream_worker_create_audio(const IHS_StreamAudioCallbacks *callbacks, void *context,
+                                            void (*arrival)(long long us)) {
+    stream_worker_t *worker = worker_create(false, context);
+    worker->callbacks.audio = callbacks;
+    worker->arrival = arrival;
+    return worker;
+}
+
+void stream_worker_set_blocking(stream_worker_t *worker, bool blocking) {
+    worker->blocking = blocking;
+}
+
+void stream_worker_destroy(stream_worker_t *worker) {
+    // Session may be torn down without its stop callback
+    if (worker->started) {
+        worker_stop(worker);
+    }
+    if (worker->jitter != NULL) {
+        jitter_buffer_destroy(worker->jitter);
+    }
+    spsc_ring_deinit(&worker->ring);
+    sem_destroy(&worker->available);
+    sem_destroy(&worker->space);
+    free(worker);
+}
+
+const IHS_StreamVideoCallbacks *stream_worker_video_callbacks() {
+    return &worker_video_callbacks;
+}
+
+const IHS_StreamAudioCallbacks *stream_worker_audio_callbacks() {
+    return &worker_audio_callbacks;
+}
+
+static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context) {
+    stream_worker_t *worker = context;
+    int ret = worker->callbacks.video->start(session, config, worker->context);
+    if (ret != 0) {
+        return ret;
+    }
+    backpressure_init(&worker->backpressure, config->codec);
+    if (worker->jitter != NULL) {
+        jitter_buffer_reset(worker->jitter);
+    }
+    if (!worker_start(worker, session)) {
+        worker->callbacks.video->stop(session, worker->context);
+        return -1;
+    }
+    return 0;
+}
+
+static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context) {
+    stream_worker_t *worker = context;
+    int ret = atomic_exchange(&worker->pending_result, DR_OK);
+    int drop_result;
+    // Worker falling behind, skip what nothing else depends on. A blocking submit waits for it instead
+    bool backlogged = !worker->blocking &&
+                      spsc_ring_size(&worker->ring) >= spsc_ring_capacity(&worker->ring) / 2;
+    if (!backpressure_admit(&worker->backpressure, data, flags, backlogged, &drop_result)) {
+        return drop_result != DR_OK ? drop_result : ret;
+    }
+    if (!worker_enqueue(worker, data, flags)) {
+        drop_result = backpressure_lost(&worker->backpressure, data);
+        return drop_result != DR_OK ? drop_result : ret;
+    }
+    return ret;
+}
+
+static void video_stop(IHS_Session *session, void *context) {
+    stream_worker_t *worker = context;
+    worker_stop(worker);
+    worker->callbacks.video->stop(session, worker->context);
+    // Right after the module's own stats, which only count what got through
+    worker_print_stats(worker);
+    backpressure_print_stats(&worker->backpressure);
+    if (worker->jitter != NULL) {
+        jitter_buffer_print_stats(worker->jitter);
+    }
+}
+
+static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context) {
+    stream_worker_t *worker = context;
+    int ret = worker->callbacks.audio->start(session, config, worker->context);
+    if (ret != 0) {
+        return ret;
+    }
+    if (!worker_start(worker, session)) {
+        worker->callbacks.audio->stop(session, worker->context);
+        return -1;
+    }
+    return 0;
+}
+
+static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context) {
+    stream_worker_t *worker = context;
+    // Audio decoder recovers by itself from a lost packet
+    worker_enqueue(worker, data, 0);
+    return atomic_exchange(&worker->pending_result, 0);
+}
+
+static void audio_stop(IHS_Session *session, void *context) {
+    stream_worker_t *worker = context;
+    worker_stop(worker);
+    worker->callbacks.audio->stop(session, worker->context);
+    worker_print_stats(worker);
+}
+
+static stream_worker_t *worker_create(bool video, void *context) {
+    stream_worker_t *worker = calloc(1, sizeof(stream_worker_t));
+    worker->video = video;
+    worker->context = context;
+    spsc_ring_init(&worker->ring, video ? VIDEO_RING_SIZE : AUDIO_RING_SIZE);
+    sem_init(&worker->available, 0, 0);
+    sem_init(&worker->space, 0, 0);
+    atomic_init(&worker->running, false);
+    atomic_init(&worker->pending_result, 0);
+    return worker;
+}
+
+static bool worker_start(stream_worker_t *worker, IHS_Session *session) {
+    worker->session = session;
+    atomic_store(&worker->pending_result, 0);
+    memset(&worker->enqueue_stats, 0, sizeof(worker->enqueue_stats));
+    memset(&worker->dequeue_stats, 0, sizeof(worker->dequeue_stats));
+    atomic_store(&worker->running, true);
+    if (pthread_create(&worker->thread, NULL, worker_run, worker) != 0) {
+        atomic_store(&worker->running, false);
+        return false;
+    }
+    worker->started = true;
+    return true;
+}
+
+static void worker_stop(stream_worker_t *worker) {
+    if (worker->started) {
+        atomic_store(&worker->running, false);
+        sem_post(&worker->available);
+        pthread_join(worker->thread, NULL);
+        worker->started = false;
+    }
+    // Producer is stopped as well, the ring is ours now
+    stream_packet_t *packet;
+    while ((packet = spsc_ring_pop(&worker->ring)) != NULL) {
+        free_packet(packet);
+    }
+    while (sem_trywait(&worker->available) == 0) {
+    }
+    while (sem_trywait(&worker->space) == 0) {
+    }
+}
+
+static void worker_print_stats(stream_worker_t *worker) {
+    // Video frames the backpressure policy turned away never reached the ring
+    uint64_t received = worker->enqueue_stats.packets, dropped = worker->enqueue_stats.overflows;
+    if (worker->video) {
+        received = worker->backpressure.stats.frames;
+        dropped += worker->backpressure.stats.dropped_non_reference + worker->backpressure.stats.dropped_broken;
+    }
+    if (received == 0) {
+        return;
+    }
+    printf("%s submit worker: %llu packets, %llu dropped (%llu overflows), ring occupancy avg %.1f max %zu of %zu, "
+           "enqueue to dequeue avg %.3f ms max %.3f ms\n", worker->video ? "Video" : "Audio",
+           (unsigned long long) received, (unsigned long long) dropped,
+           (unsigned long long) worker->enqueue_stats.overflows,
+           worker->enqueue_stats.packets > 0 ? (double) worker->enqueue_stats.occupancy_sum /
+                                               (double) worker->enqueue_stats.packets : 0,
+           worker->enqueue_stats.occupancy_max, spsc_ring_capacity(&worker->ring),
+           worker->dequeue_stats.packets > 0 ? (double) worker->dequeue_stats.latency_us / 1000.0 /
+                                               (double) worker->dequeue_stats.packets : 0,
+           (double) worker->dequeue_stats.latency_max / 1000.0);
+}
+
+static bool worker_enqueue(stream_worker_t *worker, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags) {
+    size_t occupancy = spsc_ring_size(&worker->ring);
+    worker->enqueue_stats.packets++;
+    worker->enqueue_stats.occupancy_sum += occupancy;
+    if (occupancy > worker->enqueue_stats.occupancy_max) {
+        worker->enqueue_stats.occupancy_max = occupancy;
+    }
+    stream_packet_t *packet = malloc(sizeof(stream_packet_t));
+    if (packet == NULL) {
+        worker->enqueue_stats.overflows++;
+        return false;
+    }
+    IHS_BufferInit(&packet->data, 0, data->size);
+    IHS_BufferAppendMem(&packet->data, IHS_BufferPointer(data), data->size);
+    // Copy is short if either allocation failed, out of memory is handled like a full ring
+    if (packet->data.size != data->size) {
+        worker->enqueue_stats.overflows++;
+        free_packet(packet);
+        return false;
+    }
+    packet->flags = flags;
+    packet->enqueued = ticks_us();
+    packet->release = worker->jitter != NULL ? jitter_buffer_schedule(worker->jitter, packet->enqueued)
+                                             : packet->enqueued;
+    bool pushed = spsc_ring_push(&worker->ring, packet);
+    // Posts from earlier pops may be left over, so check the ring again after every wake up
+    while (!pushed && worker->blocking) {
+        while (sem_wait(&worker->space) != 0 && errno == EINTR) {
+        }
+        pushed = spsc_ring_push(&worker->ring, packet);
+    }
+    if (!pushed) {
+        worker->enqueue_stats.overflows++;
+        free_packet(packet);
+        return false;
+    }
+    sem_post(&worker->available);
+    return true;
+}
+
+static void *worker_run(void *arg) {
+    stream_worker_t *worker = arg;
+    while (true) {
+        while (sem_wait(&worker->available) != 0 && errno == EINTR) {
+        }
+        if (!atomic_load(&worker->running)) {
+            break;
+        }
+        stream_packet_t *packet = spsc_ring_pop(&worker->ring);
+        if (packet == NULL) {
+            continue;
+        }
+        if (worker->blocking) {
+            sem_post(&worker->space);
+        }
+        // Release times only grow, so nothing behind this packet is due earlier
+        long long now = ticks_us();
+        if (packet->release > now) {
+            struct timespec until = {
+                    .tv_sec = packet->release / 1000000,
+                    .tv_nsec = (packet->release % 1000000) * 1000,
+            };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+            }
+            now = ticks_us();
+        }
+        long long latency = now - packet->enqueued;
+        worker->dequeue_stats.packets++;
+        worker->dequeue_stats.latency_us += latency;
+        if (latency > worker->dequeue_stats.latency_max) {
+            worker->dequeue_stats.latency_max = latency;
+        }
+        // Timing derived from arrival would otherwise include ring wait and jitter buffer hold
+        if (worker->arrival != NULL) {
+            worker->arrival(packet->enqueued);
+        }
+        int ret;
+        if (worker->video) {
+            ret = worker->callbacks.video->submit(worker->session, &packet->data, packet->flags, worker->context);
+        } else {
+            ret = worker->callbacks.audio->submit(worker->session, &packet->data, worker->context);
+        }
+        free_packet(packet);
+        if (ret != 0) {
+            atomic_store(&worker->pending_result, ret);
+        }
+    }
+    return NULL;
+}
+
+static void free_packet(stream_packet_t *packet) {
+    IHS_BufferClear(&packet->data, true);
+    free(packet);
+}
+
+static long long ticks_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "ihslib.h"
+
+typedef struct stream_worker_t stream_worker_t;
+
+/**
+ * Move decoder work off ihslib's receive thread. Submitted data is copied into a lock-free ring, and handed to the
+ * module's callbacks on a thread of its own, so a slow decoder never holds up packet reception.
+ *
+ * @param jitter_target_ms Maximum hold time of the jitter buffer, 0 to disable it
+ * @param arrival Called on the worker thread right before each submit with the packet's receive time, may be NULL
+ */
+stream_worker_t *stream_worker_create_video(const IHS_StreamVideoCallbacks *callbacks, void *context,
+                                            int jitter_target_ms, void (*arrival)(long long us));
+
+/**
+ * @param arrival Called on the worker thread right before each submit with the packet's receive time, may be NULL
+ */
+stream_worker_t *stream_worker_create_audio(const IHS_StreamAudioCallbacks *callbacks, void *context,
+                                            void (*arrival)(long long us));
+
+void stream_worker_destroy(stream_worker_t *worker);
+
+/**
+ * Make submit wait for ring space instead of dropping frames, for sources that can't answer a key frame request
+ * and don't lose anything by waiting, like a replayed recording. Set before the stream starts.
+ */
+void stream_worker_set_blocking(stream_worker_t *worker, bool blocking);
+
+/**
+ * Callbacks to give to ihslib, with the video worker as context.
+ */
+const IHS_StreamVideoCallbacks *stream_worker_video_callbacks();
+
+/**
+ * Callbacks to give to ihslib, with the audio worker as context.
+ */
+const IHS_StreamAudioCallbacks *stream_worker_audio_callbacks();
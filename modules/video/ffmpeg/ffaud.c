@@ -0,0 +1,236 @@
+// Software audio decode using libavcodec, played through SDL audio queue
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <libavcodec/avcodec.h>
+
+#include <ihslib.h>
+
+#include "ffmpeg_module.h"
+
+/* Drop queued audio when it grows beyond this, instead of letting latency pile up */
+#define MAX_QUEUED_MS 100
+
+static AVCodecContext *codec_ctx = NULL;
+static AVPacket *packet = NULL;
+static AVFrame *frame = NULL;
+static uint8_t *packet_data = NULL;
+static unsigned int packet_data_size = 0;
+
+static SDL_AudioDeviceID device = 0;
+static float *pcm_buffer = NULL;
+static size_t pcm_buffer_samples = 0;
+static Uint32 max_queued_bytes = 0;
+
+static pthread_mutex_t audio_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool suspended = false;
+
+static struct {
+    uint64_t frames;
+    uint64_t overflows;
+} stats;
+
+static int frame_channels(const AVFrame *f);
+
+static bool queue_frame(const AVFrame *f);
+
+static void release_decoder();
+
+static int ffaud_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context) {
+    enum AVCodecID codec_id;
+    switch (config->codec) {
+        case IHS_StreamAudioCodecOpus:
+            codec_id = AV_CODEC_ID_OPUS;
+            break;
+        case IHS_StreamAudioCodecMP3:
+            codec_id = AV_CODEC_ID_MP3;
+            break;
+        default:
+            return ERROR_UNKNOWN_CODEC;
+    }
+    const AVCodec *codec = avcodec_find_decoder(codec_id);
+    if (codec == NULL) {
+        return ERROR_UNKNOWN_CODEC;
+    }
+    codec_ctx = avcodec_alloc_context3(codec);
+    if (codec_ctx == NULL) {
+        return ERROR_AUDIO_OPEN_FAILED;
+    }
+    codec_ctx->sample_rate = (int) config->frequency;
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 24, 100)
+    av_channel_layout_default(&codec_ctx->ch_layout, (int) config->channels);
+#else
+    codec_ctx->channels = (int) config->channels;
+    codec_ctx->channel_layout = av_get_default_channel_layout((int) config->channels);
+#endif
+    // Interleaved output can be queued to SDL directly
+    codec_ctx->request_sample_fmt = AV_SAMPLE_FMT_FLT;
+    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+        avcodec_free_context(&codec_ctx);
+        return ERROR_AUDIO_OPEN_FAILED;
+    }
+    packet = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (packet == NULL || frame == NULL) {
+        release_decoder();
+        return ERROR_AUDIO_OPEN_FAILED;
+    }
+
+    if (!SDL_WasInit(SDL_INIT_AUDIO) && SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        fprintf(stderr, "Can't init SDL audio: %s\n", SDL_GetError());
+        release_decoder();
+        return ERROR_AUDIO_OPEN_FAILED;
+    }
+    SDL_AudioSpec want = {
+            .freq = (int) config->frequency,
+            .format = AUDIO_F32SYS,
+            .channels = (Uint8) config->channels,
+            .samples = 480,
+    }, have;
+    device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (device == 0) {
+        fprintf(stderr, "Can't open audio device: %s\n", SDL_GetError());
+        release_decoder();
+        return ERROR_AUDIO_OPEN_FAILED;
+    }
+    max_queued_bytes = config->frequency * config->channels * sizeof(float) * MAX_QUEUED_MS / 1000;
+    memset(&stats, 0, sizeof(stats));
+    suspended = false;
+    SDL_PauseAudioDevice(device, 0);
+    return 0;
+}
+
+static void ffaud_stop(IHS_Session *session, void *context) {
+    pthread_mutex_lock(&audio_lock);
+    if (device != 0) {
+        SDL_CloseAudioDevice(device);
+        device = 0;
+    }
+    pthread_mutex_unlock(&audio_lock);
+    if (stats.frames > 0) {
+        printf("Audio stats: %llu frames decoded, %llu queue overflows\n", (unsigned long long) stats.frames,
+               (unsigned long long) stats.overflows);
+    }
+    release_decoder();
+    av_freep(&packet_data);
+    packet_data_size = 0;
+    av_freep(&pcm_buffer);
+    pcm_buffer_samples = 0;
+}
+
+static int ffaud_submit(IHS_Session *session, IHS_Buffer *data, void *context) {
+    if (codec_ctx == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&audio_lock);
+    if (suspended) {
+        pthread_mutex_unlock(&audio_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&audio_lock);
+    size_t size = data->size;
+    av_fast_padded_malloc(&packet_data, &packet_data_size, size);
+    if (packet_data == NULL) {
+        return -1;
+    }
+    IHS_BufferReadMem(data, 0, packet_data, size);
+    packet->data = packet_data;
+    packet->size = (int) size;
+    int ret = avcodec_send_packet(codec_ctx, packet);
+    if (ret < 0) {
+        fprintf(stderr, "Audio decode error: %s\n", av_err2str(ret));
+        return 0;
+    }
+    while (avcodec_receive_frame(codec_ctx, frame) == 0) {
+        stats.frames++;
+        queue_frame(frame);
+        av_frame_unref(frame);
+    }
+    return 0;
+}
+
+void ffaud_suspend() {
+    pthread_mutex_lock(&audio_lock);
+    if (device != 0 && !suspended) {
+        SDL_PauseAudioDevice(device, 1);
+        SDL_ClearQueuedAudio(device);
+        suspended = true;
+    }
+    pthread_mutex_unlock(&audio_lock);
+}
+
+void ffaud_resume() {
+    pthread_mutex_lock(&audio_lock);
+    if (device != 0 && suspended) {
+        SDL_PauseAudioDevice(device, 0);
+        suspended = false;
+    }
+    pthread_mutex_unlock(&audio_lock);
+}
+
+static int frame_channels(const AVFrame *f) {
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 24, 100)
+    return f->ch_layout.nb_channels;
+#else
+    return f->channels;
+#endif
+}
+
+static bool queue_frame(const AVFrame *f) {
+    int channels = frame_channels(f);
+    size_t samples = (size_t) f->nb_samples * channels;
+    const void *pcm;
+    switch (f->format) {
+        case AV_SAMPLE_FMT_FLT:
+            pcm = f->data[0];
+            break;
+        case AV_SAMPLE_FMT_FLTP: {
+            if (pcm_buffer_samples < samples) {
+                av_freep(&pcm_buffer);
+                pcm_buffer = av_malloc_array(samples, sizeof(float));
+                pcm_buffer_samples = pcm_buffer != NULL ? samples : 0;
+            }
+            if (pcm_buffer == NULL) {
+                return false;
+            }
+            for (int ch = 0; ch < channels; ch++) {
+                const float *plane = (const float *) f->extended_data[ch];
+                for (int i = 0; i < f->nb_samples; i++) {
+                    pcm_buffer[i * channels + ch] = plane[i];
+                }
+            }
+            pcm = pcm_buffer;
+            break;
+        }
+        default:
+            fprintf(stderr, "Unsupported sample format %s\n", av_get_sample_fmt_name(f->format));
+            return false;
+    }
+    if (SDL_GetQueuedAudioSize(device) > max_queued_bytes) {
+        // Device is behind, skipping this frame takes latency back without a gap of the whole queue
+        stats.overflows++;
+        return false;
+    }
+    return SDL_QueueAudio(device, pcm, samples * sizeof(float)) == 0;
+}
+
+/**
+ * Leaves codec_ctx NULL, so submit stops decoding.
+ */
+static void release_decoder() {
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codec_ctx);
+}
+
+const IHS_StreamAudioCallbacks AudioCallbacks = {
+        .start = ffaud_start,
+        .stop = ffaud_stop,
+        .submit = ffaud_submit,
+};
+
+const IHS_StreamAudioCallbacks *ffaud_callbacks() {
+    return &AudioCallbacks;
+}
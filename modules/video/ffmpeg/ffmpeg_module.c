@@ -0,0 +1,70 @@
+#include "ffmpeg_module.h"
+#include "yuv_convert.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+
+static void ffmpeg_init(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+    int thread_type = FF_THREAD_SLICE, thread_count = 0;
+    const char *type = getenv("IHSPLAY_FFMPEG_THREAD_TYPE");
+    if (type != NULL && strcmp(type, "frame") == 0) {
+        thread_type = FF_THREAD_FRAME;
+    }
+    const char *count = getenv("IHSPLAY_FFMPEG_THREADS");
+    if (count != NULL) {
+        thread_count = atoi(count);
+    }
+    ffvid_set_threading(thread_type, thread_count);
+    ffvid_set_force_rgb(getenv("IHSPLAY_FFMPEG_FORCE_RGB") != NULL);
+    present_mode_t present_mode = PRESENT_MODE_MAILBOX;
+    const char *mode = getenv("IHSPLAY_PRESENT_MODE");
+    if (mode != NULL && !present_mode_parse(mode, &present_mode)) {
+        fprintf(stderr, "Unknown present mode %s, expected mailbox, fifo or immediate\n", mode);
+    }
+    int fifo_depth = 3;
+    const char *depth = getenv("IHSPLAY_PRESENT_FIFO_DEPTH");
+    if (depth != NULL) {
+        fifo_depth = atoi(depth);
+    }
+    ffvid_set_present_mode(present_mode, fifo_depth);
+}
+
+static void ffmpeg_post_init(int argc, char *argv[]) {
+    if (getenv("IHSPLAY_YUV_BENCHMARK") != NULL) {
+        yuv_convert_benchmark();
+    }
+}
+
+static void ffmpeg_suspend() {
+    ffvid_suspend();
+    ffaud_suspend();
+}
+
+static void ffmpeg_resume() {
+    ffvid_resume();
+    ffaud_resume();
+}
+
+static bool ffmpeg_probe() {
+    // libavcodec may be built without the decoders we need
+    return avcodec_find_decoder(AV_CODEC_ID_H264) != NULL;
+}
+
+IHSPLAY_MODULE_EXPORT const ihsplay_module_t ihsplay_module = {
+        .name = "ffmpeg",
+        .probe = ffmpeg_probe,
+        .init = ffmpeg_init,
+        .post_init = ffmpeg_post_init,
+        .audio = ffaud_callbacks,
+        .video = ffvid_callbacks,
+        .suspend = ffmpeg_suspend,
+        .resume = ffmpeg_resume,
+        .video_update = ffvid_update,
+        .video_draw = ffvid_draw,
+        .video_presented = ffvid_presented,
+};
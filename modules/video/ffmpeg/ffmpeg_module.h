@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <SDL.h>
+
+#include "module.h"
+#include "presenter.h"
+
+#define ERROR_UNKNOWN_CODEC 0x1010
+#define ERROR_DECODER_OPEN_FAILED 0x1011
+#define ERROR_AUDIO_OPEN_FAILED 0x1021
+
+/**
+ * @param thread_type FF_THREAD_SLICE or FF_THREAD_FRAME. Frame threading adds one frame of delay per thread.
+ * @param thread_count 0 to let libavcodec decide
+ */
+void ffvid_set_threading(int thread_type, int thread_count);
+
+/**
+ * Always convert to RGB with our own kernels, even if renderer accepts YUV textures. Useful for benchmarking.
+ */
+void ffvid_set_force_rgb(bool force);
+
+/**
+ * @param fifo_depth Number of frames queued in PRESENT_MODE_FIFO
+ */
+void ffvid_set_present_mode(present_mode_t mode, int fifo_depth);
+
+const IHS_StreamVideoCallbacks *ffvid_callbacks();
+
+void ffvid_suspend();
+
+void ffvid_resume();
+
+bool ffvid_update(SDL_Renderer *renderer);
+
+void ffvid_draw(SDL_Renderer *renderer);
+
+void ffvid_presented();
+
+const IHS_StreamAudioCallbacks *ffaud_callbacks();
+
+void ffaud_suspend();
+
+void ffaud_resume();
@@ -0,0 +1,554 @@
+// Software video decode using libavcodec, presented through SDL streaming YUV textures
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixdesc.h>
+
+#include <ihslib.h>
+
+#include "annexb.h"
+#include "backpressure.h"
+#include "ffmpeg_module.h"
+#include "param_cache.h"
+#include "sps_parser.h"
+#include "yuv_convert.h"
+
+#define MAX_RESOLUTION_STATS 4
+
+static AVCodecContext *codec_ctx = NULL;
+static AVPacket *packet = NULL;
+static AVFrame *decoded = NULL;
+static uint8_t *packet_data = NULL;
+static unsigned int packet_data_size = 0;
+
+static backpressure_t backpressure;
+/* Parameter sets go in front of the first packet a freshly opened decoder gets, unless it has its own */
+static param_cache_t param_cache;
+static bool inject_params = false;
+
+static int decoder_thread_type = FF_THREAD_SLICE, decoder_thread_count = 0;
+/* Output every frame as soon as it's decoded, unless the SPS says the stream reorders pictures */
+static bool decoder_low_delay = true;
+/* Reopening for the other mode failed once, the running decoder is kept for the rest of the session */
+static bool low_delay_locked = false;
+
+/* Hands decoded frames from the network thread to the main thread */
+static presenter_t *presenter = NULL;
+static present_mode_t present_mode = PRESENT_MODE_MAILBOX;
+static int present_fifo_depth = 3;
+
+static pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool active = false, suspended = false, need_keyframe = false, keyframe_requested = false;
+
+/* Main thread only */
+static AVFrame *current = NULL;
+static int renderer_vsync = -1;
+static bool frame_uploaded = false;
+/* Uploads go to the texture not being displayed, so they never wait for the GPU to finish with it */
+static SDL_Texture *textures[2] = {NULL, NULL};
+static int front_texture = 0;
+static int texture_width = 0, texture_height = 0;
+static Uint32 texture_format = SDL_PIXELFORMAT_UNKNOWN;
+static enum AVPixelFormat texture_source_format = AV_PIX_FMT_NONE;
+static bool force_rgb = false;
+static const yuv_converter_t *rgb_converter = NULL;
+static const yuv_coefficients_t *rgb_coefficients = NULL;
+
+typedef struct upload_stats_t {
+    int width, height;
+    Uint32 format;
+    uint64_t frames;
+    uint64_t ticks;
+} upload_stats_t;
+
+static upload_stats_t upload_stats[MAX_RESOLUTION_STATS];
+
+static struct {
+    uint64_t decoded;
+    uint64_t decode_ticks;
+} stats;
+
+static bool upload_frame(SDL_Renderer *renderer, const AVFrame *frame);
+
+static bool setup_textures(SDL_Renderer *renderer, const AVFrame *frame);
+
+static bool renderer_supports(SDL_Renderer *renderer, Uint32 format);
+
+static void record_upload(Uint64 ticks);
+
+static void print_upload_stats();
+
+static void release_texture();
+
+static AVCodecContext *open_codec(const AVCodec *codec, int width, int height, bool low_delay);
+
+static void update_low_delay(IHS_Buffer *data);
+
+static void release_decoder();
+
+void ffvid_set_threading(int thread_type, int thread_count) {
+    decoder_thread_type = thread_type;
+    decoder_thread_count = thread_count;
+}
+
+void ffvid_set_force_rgb(bool force) {
+    force_rgb = force;
+}
+
+void ffvid_set_present_mode(present_mode_t mode, int fifo_depth) {
+    present_mode = mode;
+    present_fifo_depth = fifo_depth;
+}
+
+static int ffvid_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context) {
+    enum AVCodecID codec_id;
+    switch (config->codec) {
+        case IHS_StreamVideoCodecH264:
+            codec_id = AV_CODEC_ID_H264;
+            break;
+        case IHS_StreamVideoCodecHEVC:
+            codec_id = AV_CODEC_ID_HEVC;
+            break;
+        case IHS_StreamVideoCodecVP9:
+            codec_id = AV_CODEC_ID_VP9;
+            break;
+        default:
+            fprintf(stderr, "Video format not supported\n");
+            return ERROR_UNKNOWN_CODEC;
+    }
+    const AVCodec *codec = avcodec_find_decoder(codec_id);
+    if (codec == NULL) {
+        fprintf(stderr, "Can't find decoder for %s\n", avcodec_get_name(codec_id));
+        return ERROR_UNKNOWN_CODEC;
+    }
+    // Game streams normally have no B-frame reordering, the first SPS tells for sure
+    decoder_low_delay = true;
+    low_delay_locked = false;
+    codec_ctx = open_codec(codec, (int) config->width, (int) config->height, decoder_low_delay);
+    if (codec_ctx == NULL) {
+        return ERROR_DECODER_OPEN_FAILED;
+    }
+    packet = av_packet_alloc();
+    decoded = av_frame_alloc();
+    if (packet == NULL || decoded == NULL) {
+        release_decoder();
+        return ERROR_DECODER_OPEN_FAILED;
+    }
+
+    pthread_mutex_lock(&frame_lock);
+    if (presenter == NULL) {
+        presenter = presenter_create(present_mode, present_fifo_depth);
+        if (presenter == NULL) {
+            pthread_mutex_unlock(&frame_lock);
+            release_decoder();
+            return ERROR_DECODER_OPEN_FAILED;
+        }
+    }
+    presenter_reset_stats(presenter);
+    active = true;
+    suspended = false;
+    need_keyframe = false;
+    pthread_mutex_unlock(&frame_lock);
+
+    memset(&stats, 0, sizeof(stats));
+    backpressure_init(&backpressure, config->codec);
+    param_cache_init(&param_cache, config->codec);
+    inject_params = true;
+    printf("%s decoder initialized, %d %s threads\n", codec->name, codec_ctx->thread_count,
+           codec_ctx->active_thread_type == FF_THREAD_FRAME ? "frame" : "slice");
+    return 0;
+}
+
+static void ffvid_stop(IHS_Session *session, void *context) {
+    pthread_mutex_lock(&frame_lock);
+    active = false;
+    if (presenter != NULL) {
+        presenter_flush(presenter);
+    }
+    pthread_mutex_unlock(&frame_lock);
+
+    if (stats.decoded > 0) {
+        printf("Video decoder stats: %llu frames decoded, avg decode %.2f ms\n", (unsigned long long) stats.decoded,
+               (double) stats.decode_ticks * 1000.0 / (double) SDL_GetPerformanceFrequency() /
+               (double) stats.decoded);
+    }
+    backpressure_print_stats(&backpressure);
+    param_cache_print_stats(&param_cache);
+
+    release_decoder();
+    av_freep(&packet_data);
+    packet_data_size = 0;
+}
+
+static int ffvid_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context) {
+    if (codec_ctx == NULL) {
+        return DR_NEED_IDR;
+    }
+    bool keyframe = flags & IHS_StreamVideoFrameKeyFrame;
+    bool has_params = param_cache_update(&param_cache, IHS_BufferPointer(data), data->size);
+    pthread_mutex_lock(&frame_lock);
+    if (suspended) {
+        // Nothing to present to. Key frame will be requested on resume
+        pthread_mutex_unlock(&frame_lock);
+        return DR_OK;
+    }
+    bool flush = false;
+    if (need_keyframe) {
+        // A frame with recovery point SEI starts a refresh, and libavcodec holds output back until it completes
+        if (!keyframe && !param_cache_can_resume(&param_cache)) {
+            // Ask only once, the host will send an IDR shortly
+            int ret = keyframe_requested ? DR_OK : DR_NEED_IDR;
+            keyframe_requested = true;
+            pthread_mutex_unlock(&frame_lock);
+            return ret;
+        }
+        need_keyframe = false;
+        flush = true;
+        if (!keyframe) {
+            param_cache.stats.idr_avoided++;
+        }
+    }
+    pthread_mutex_unlock(&frame_lock);
+    if (flush) {
+        avcodec_flush_buffers(codec_ctx);
+    }
+    if (keyframe && (codec_ctx->codec_id == AV_CODEC_ID_H264 || codec_ctx->codec_id == AV_CODEC_ID_HEVC)) {
+        update_low_delay(data);
+    }
+    int ret;
+    // Decoding is synchronous, so there is never a backlog. This only holds frames back after a lost reference
+    if (!backpressure_admit(&backpressure, data, flags, false, &ret)) {
+        return ret;
+    }
+
+    // libavcodec may read past the end of packet, so it needs padded memory
+    size_t params_size = inject_params && !has_params ? param_cache_size(&param_cache) : 0;
+    size_t size = params_size + data->size;
+    av_fast_padded_malloc(&packet_data, &packet_data_size, size);
+    if (packet_data == NULL) {
+        return backpressure_lost(&backpressure, data);
+    }
+    param_cache_write(&param_cache, packet_data, params_size);
+    IHS_BufferReadMem(data, 0, packet_data + params_size, data->size);
+    packet->data = packet_data;
+    packet->size = (int) size;
+    packet->flags = keyframe ? AV_PKT_FLAG_KEY : 0;
+
+    Uint64 begin = SDL_GetPerformanceCounter();
+    ret = avcodec_send_packet(codec_ctx, packet);
+    if (ret < 0) {
+        fprintf(stderr, "Video decode error: %s\n", av_err2str(ret));
+        return backpressure_lost(&backpressure, data);
+    }
+    inject_params = false;
+    while ((ret = avcodec_receive_frame(codec_ctx, decoded)) == 0) {
+        stats.decode_ticks += SDL_GetPerformanceCounter() - begin;
+        stats.decoded++;
+        presenter_push(presenter, decoded);
+        begin = SDL_GetPerformanceCounter();
+    }
+    if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+        fprintf(stderr, "Video decode error: %s\n", av_err2str(ret));
+        return backpressure_lost(&backpressure, data);
+    }
+    return DR_OK;
+}
+
+static AVCodecContext *open_codec(const AVCodec *codec, int width, int height, bool low_delay) {
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->width = width;
+    ctx->height = height;
+    if (low_delay) {
+        ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    }
+    ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    ctx->thread_type = decoder_thread_type;
+    ctx->thread_count = decoder_thread_count;
+    if (avcodec_open2(ctx, codec, NULL) < 0) {
+        fprintf(stderr, "Can't open decoder\n");
+        avcodec_free_context(&ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/**
+ * Low delay output of a reordered stream shows frames in the wrong order, and the flag can't change once opened,
+ * so reopen the decoder when the SPS disagrees with it. The running decoder stays if the new one can't be opened.
+ */
+static void update_low_delay(IHS_Buffer *data) {
+    if (low_delay_locked) {
+        return;
+    }
+    bool hevc = codec_ctx->codec_id == AV_CODEC_ID_HEVC;
+    IHS_StreamVideoCodec codec = hevc ? IHS_StreamVideoCodecHEVC : IHS_StreamVideoCodecH264;
+    nal_unit_t unit;
+    sps_info_t sps;
+    if (!annexb_find(IHS_BufferPointer(data), data->size, codec, hevc ? NAL_TYPE_HEVC_SPS : NAL_TYPE_H264_SPS,
+                     &unit)) {
+        return;
+    }
+    const unsigned char *sps_data = IHS_BufferPointerAt(data, unit.offset);
+    if (!(hevc ? sps_parse_hevc(sps_data, unit.size, &sps) : sps_parse_h264(sps_data, unit.size, &sps)) ||
+        (sps.max_num_reorder_frames == 0) == decoder_low_delay) {
+        return;
+    }
+    bool low_delay = sps.max_num_reorder_frames == 0;
+    printf("Stream has %u reorder frames, reopening decoder with%s low delay\n", sps.max_num_reorder_frames,
+           low_delay ? "" : "out");
+    AVCodecContext *ctx = open_codec(codec_ctx->codec, sps.dimension.width, sps.dimension.height, low_delay);
+    if (ctx == NULL) {
+        fprintf(stderr, "Keeping decoder with%s low delay\n", decoder_low_delay ? "" : "out");
+        low_delay_locked = true;
+        return;
+    }
+    avcodec_free_context(&codec_ctx);
+    codec_ctx = ctx;
+    decoder_low_delay = low_delay;
+    inject_params = true;
+}
+
+void ffvid_suspend() {
+    pthread_mutex_lock(&frame_lock);
+    if (active) {
+        suspended = true;
+        presenter_flush(presenter);
+    }
+    pthread_mutex_unlock(&frame_lock);
+    release_texture();
+    if (current != NULL) {
+        av_frame_unref(current);
+    }
+}
+
+void ffvid_resume() {
+    pthread_mutex_lock(&frame_lock);
+    if (active && suspended) {
+        suspended = false;
+        need_keyframe = true;
+        keyframe_requested = false;
+    }
+    pthread_mutex_unlock(&frame_lock);
+}
+
+bool ffvid_update(SDL_Renderer *renderer) {
+    bool updated;
+    pthread_mutex_lock(&frame_lock);
+    if (!active) {
+        pthread_mutex_unlock(&frame_lock);
+        // Clear the last frame of the ended session
+        updated = current != NULL && current->buf[0] != NULL;
+        if (updated) {
+            av_frame_unref(current);
+            print_upload_stats();
+            presenter_print_stats(presenter);
+        }
+        release_texture();
+        return updated;
+    }
+    pthread_mutex_unlock(&frame_lock);
+    int vsync = present_mode != PRESENT_MODE_IMMEDIATE;
+    if (renderer_vsync != vsync) {
+        // Mailbox and FIFO wait for vblank in SDL_RenderPresent, immediate never waits and may tear
+        if (SDL_RenderSetVSync(renderer, vsync) != 0) {
+            fprintf(stderr, "Can't %s vsync: %s\n", vsync ? "enable" : "disable", SDL_GetError());
+        }
+        renderer_vsync = vsync;
+    }
+    if (current == NULL) {
+        current = av_frame_alloc();
+    }
+    // FIFO hands out the oldest queued frame, one per present. Others only ever hold the newest one
+    frame_uploaded = presenter_acquire(presenter, current) && upload_frame(renderer, current);
+    return frame_uploaded;
+}
+
+void ffvid_presented() {
+    // UI redraws present too, only count the ones showing a new frame
+    if (frame_uploaded) {
+        presenter_presented(presenter);
+        frame_uploaded = false;
+    }
+}
+
+void ffvid_draw(SDL_Renderer *renderer) {
+    SDL_Texture *texture = textures[front_texture];
+    if (texture == NULL || current == NULL || current->buf[0] == NULL) {
+        return;
+    }
+    int output_width, output_height;
+    SDL_GetRendererOutputSize(renderer, &output_width, &output_height);
+    // Keep aspect ratio of the stream
+    SDL_Rect dst = {0, 0, output_width, output_height};
+    if (output_width * texture_height > output_height * texture_width) {
+        dst.w = texture_width * output_height / texture_height;
+        dst.x = (output_width - dst.w) / 2;
+    } else {
+        dst.h = texture_height * output_width / texture_width;
+        dst.y = (output_height - dst.h) / 2;
+    }
+    SDL_RenderCopy(renderer, texture, NULL, &dst);
+}
+
+static bool upload_frame(SDL_Renderer *renderer, const AVFrame *frame) {
+    if (frame->format != texture_source_format || frame->width != texture_width ||
+        frame->height != texture_height) {
+        if (!setup_textures(renderer, frame)) {
+            return false;
+        }
+    }
+    SDL_Texture *texture = textures[front_texture ^ 1];
+    Uint64 begin = SDL_GetPerformanceCounter();
+    int ret;
+    switch (texture_format) {
+        case SDL_PIXELFORMAT_IYUV:
+            ret = SDL_UpdateYUVTexture(texture, NULL, frame->data[0], frame->linesize[0], frame->data[1],
+                                       frame->linesize[1], frame->data[2], frame->linesize[2]);
+            break;
+        case SDL_PIXELFORMAT_NV12:
+            ret = SDL_UpdateNVTexture(texture, NULL, frame->data[0], frame->linesize[0], frame->data[1],
+                                      frame->linesize[1]);
+            break;
+        default: {
+            // Convert straight into texture memory, no intermediate RGB buffer
+            void *pixels;
+            int pitch;
+            if ((ret = SDL_LockTexture(texture, NULL, &pixels, &pitch)) != 0) {
+                break;
+            }
+            bool nv12 = frame->format == AV_PIX_FMT_NV12;
+            yuv_convert_frame(rgb_converter, rgb_coefficients, frame->data[0], frame->linesize[0],
+                              frame->data[1], frame->linesize[1], nv12 ? NULL : frame->data[2],
+                              frame->linesize[2], pixels, pitch, frame->width, frame->height);
+            SDL_UnlockTexture(texture);
+            break;
+        }
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Can't upload video frame: %s\n", SDL_GetError());
+        return false;
+    }
+    record_upload(SDL_GetPerformanceCounter() - begin);
+    front_texture ^= 1;
+    return true;
+}
+
+static bool setup_textures(SDL_Renderer *renderer, const AVFrame *frame) {
+    Uint32 yuv_format;
+    switch (frame->format) {
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P:
+            yuv_format = SDL_PIXELFORMAT_IYUV;
+            break;
+        case AV_PIX_FMT_NV12:
+            yuv_format = SDL_PIXELFORMAT_NV12;
+            break;
+        default:
+            fprintf(stderr, "Unsupported pixel format %s\n", av_get_pix_fmt_name(frame->format));
+            return false;
+    }
+    release_texture();
+    bool bt709 = frame->colorspace == AVCOL_SPC_BT709;
+    bool full_range = frame->color_range == AVCOL_RANGE_JPEG || frame->format == AV_PIX_FMT_YUVJ420P;
+    Uint32 format = yuv_format;
+    if (force_rgb || !renderer_supports(renderer, yuv_format)) {
+        // SDL would fall back to its own unaccelerated conversion, do it with SIMD instead
+        format = SDL_PIXELFORMAT_XRGB8888;
+        rgb_converter = yuv_converter_select();
+        rgb_coefficients = yuv_coefficients(bt709 ? YUV_MATRIX_BT709 : YUV_MATRIX_BT601, full_range);
+    } else {
+        SDL_SetYUVConversionMode(full_range ? SDL_YUV_CONVERSION_JPEG : bt709 ? SDL_YUV_CONVERSION_BT709
+                                                                              : SDL_YUV_CONVERSION_BT601);
+    }
+    for (int i = 0; i < 2; i++) {
+        textures[i] = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING, frame->width, frame->height);
+        if (textures[i] == NULL) {
+            fprintf(stderr, "Can't create video texture: %s\n", SDL_GetError());
+            release_texture();
+            return false;
+        }
+    }
+    texture_width = frame->width;
+    texture_height = frame->height;
+    texture_format = format;
+    texture_source_format = frame->format;
+    printf("Video textures %d x %d, %s%s%s\n", texture_width, texture_height, SDL_GetPixelFormatName(format),
+           rgb_converter != NULL && format == SDL_PIXELFORMAT_XRGB8888 ? " converted by " : "",
+           rgb_converter != NULL && format == SDL_PIXELFORMAT_XRGB8888 ? rgb_converter->name : "");
+    return true;
+}
+
+static bool renderer_supports(SDL_Renderer *renderer, Uint32 format) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(renderer, &info) != 0) {
+        return false;
+    }
+    for (Uint32 i = 0; i < info.num_texture_formats; i++) {
+        if (info.texture_formats[i] == format) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void record_upload(Uint64 ticks) {
+    for (int i = 0; i < MAX_RESOLUTION_STATS; i++) {
+        upload_stats_t *item = &upload_stats[i];
+        if (item->frames == 0) {
+            item->width = texture_width;
+            item->height = texture_height;
+            item->format = texture_format;
+        } else if (item->width != texture_width || item->height != texture_height ||
+                   item->format != texture_format) {
+            continue;
+        }
+        item->frames++;
+        item->ticks += ticks;
+        return;
+    }
+}
+
+static void print_upload_stats() {
+    for (int i = 0; i < MAX_RESOLUTION_STATS && upload_stats[i].frames > 0; i++) {
+        const upload_stats_t *item = &upload_stats[i];
+        printf("Video upload %d x %d %s: %llu frames, avg %.3f ms\n", item->width, item->height,
+               SDL_GetPixelFormatName(item->format), (unsigned long long) item->frames,
+               (double) item->ticks * 1000.0 / (double) SDL_GetPerformanceFrequency() / (double) item->frames);
+    }
+    memset(upload_stats, 0, sizeof(upload_stats));
+}
+
+static void release_texture() {
+    for (int i = 0; i < 2; i++) {
+        if (textures[i] != NULL) {
+            SDL_DestroyTexture(textures[i]);
+            textures[i] = NULL;
+        }
+    }
+    front_texture = 0;
+    texture_width = texture_height = 0;
+    texture_format = SDL_PIXELFORMAT_UNKNOWN;
+    texture_source_format = AV_PIX_FMT_NONE;
+}
+
+static void release_decoder() {
+    av_frame_free(&decoded);
+    av_packet_free(&packet);
+    avcodec_free_context(&codec_ctx);
+}
+
+const IHS_StreamVideoCallbacks VideoCallbacks = {
+        .start = ffvid_start,
+        .submit = ffvid_submit,
+        .stop = ffvid_stop,
+};
+
+const IHS_StreamVideoCallbacks *ffvid_callbacks() {
+    return &VideoCallbacks;
+}
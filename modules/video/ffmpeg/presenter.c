@@ -0,0 +1,195 @@
+// Presentation scheduling of CPU decoded frames
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <SDL.h>
+
+#include "presenter.h"
+
+#define MAX_FIFO_DEPTH 8
+/* FIFO push waits this long for a free slot. Presentation stalled beyond that, e.g. app in background */
+#define FIFO_PUSH_TIMEOUT_MS 100
+
+typedef struct queued_frame_t {
+    AVFrame *frame;
+    Uint64 decoded_at;
+} queued_frame_t;
+
+struct presenter_t {
+    present_mode_t mode;
+    int depth;
+    pthread_mutex_t lock;
+    /* Signalled when a queued frame is taken, FIFO push waits for it */
+    pthread_cond_t space;
+    queued_frame_t queue[MAX_FIFO_DEPTH];
+    int head, count;
+
+    /* Main thread only */
+    Uint64 acquired_decoded_at;
+
+    struct {
+        uint64_t pushed;
+        uint64_t presented;
+        uint64_t dropped;
+        uint64_t latency_ticks;
+        uint64_t max_latency_ticks;
+    } stats;
+};
+
+presenter_t *presenter_create(present_mode_t mode, int fifo_depth) {
+    presenter_t *presenter = calloc(1, sizeof(presenter_t));
+    if (presenter == NULL) {
+        return NULL;
+    }
+    presenter->mode = mode;
+    if (mode == PRESENT_MODE_FIFO) {
+        presenter->depth = fifo_depth < 1 ? 1 : fifo_depth > MAX_FIFO_DEPTH ? MAX_FIFO_DEPTH : fifo_depth;
+    } else {
+        presenter->depth = 1;
+    }
+    for (int i = 0; i < presenter->depth; i++) {
+        presenter->queue[i].frame = av_frame_alloc();
+        if (presenter->queue[i].frame == NULL) {
+            while (i-- > 0) {
+                av_frame_free(&presenter->queue[i].frame);
+            }
+            free(presenter);
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&presenter->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&presenter->space, &attr);
+    pthread_condattr_destroy(&attr);
+    return presenter;
+}
+
+void presenter_destroy(presenter_t *presenter) {
+    for (int i = 0; i < presenter->depth; i++) {
+        av_frame_free(&presenter->queue[i].frame);
+    }
+    pthread_cond_destroy(&presenter->space);
+    pthread_mutex_destroy(&presenter->lock);
+    free(presenter);
+}
+
+present_mode_t presenter_mode(const presenter_t *presenter) {
+    return presenter->mode;
+}
+
+void presenter_push(presenter_t *presenter, AVFrame *frame) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    pthread_mutex_lock(&presenter->lock);
+    presenter->stats.pushed++;
+    if (presenter->mode == PRESENT_MODE_FIFO && presenter->count == presenter->depth) {
+        // FIFO holds the decoder back until a frame is shown, so every frame gets its vsync
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_nsec += FIFO_PUSH_TIMEOUT_MS * 1000000L;
+        until.tv_sec += until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        while (presenter->count == presenter->depth) {
+            if (pthread_cond_timedwait(&presenter->space, &presenter->lock, &until) == ETIMEDOUT) {
+                break;
+            }
+        }
+    }
+    if (presenter->count == presenter->depth) {
+        // Mailbox replaces the frame waiting for vsync. FIFO only gets here when nothing is being presented
+        queued_frame_t *oldest = &presenter->queue[presenter->head];
+        av_frame_unref(oldest->frame);
+        presenter->head = (presenter->head + 1) % presenter->depth;
+        presenter->count--;
+        presenter->stats.dropped++;
+    }
+    queued_frame_t *tail = &presenter->queue[(presenter->head + presenter->count) % presenter->depth];
+    av_frame_move_ref(tail->frame, frame);
+    tail->decoded_at = now;
+    presenter->count++;
+    pthread_mutex_unlock(&presenter->lock);
+}
+
+bool presenter_acquire(presenter_t *presenter, AVFrame *frame) {
+    pthread_mutex_lock(&presenter->lock);
+    if (presenter->count == 0) {
+        pthread_mutex_unlock(&presenter->lock);
+        return false;
+    }
+    queued_frame_t *head = &presenter->queue[presenter->head];
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, head->frame);
+    presenter->acquired_decoded_at = head->decoded_at;
+    presenter->head = (presenter->head + 1) % presenter->depth;
+    presenter->count--;
+    pthread_cond_signal(&presenter->space);
+    pthread_mutex_unlock(&presenter->lock);
+    return true;
+}
+
+void presenter_presented(presenter_t *presenter) {
+    if (presenter->acquired_decoded_at == 0) {
+        return;
+    }
+    Uint64 latency = SDL_GetPerformanceCounter() - presenter->acquired_decoded_at;
+    presenter->acquired_decoded_at = 0;
+    pthread_mutex_lock(&presenter->lock);
+    presenter->stats.presented++;
+    presenter->stats.latency_ticks += latency;
+    if (latency > presenter->stats.max_latency_ticks) {
+        presenter->stats.max_latency_ticks = latency;
+    }
+    pthread_mutex_unlock(&presenter->lock);
+}
+
+void presenter_flush(presenter_t *presenter) {
+    pthread_mutex_lock(&presenter->lock);
+    for (int i = 0; i < presenter->depth; i++) {
+        av_frame_unref(presenter->queue[i].frame);
+    }
+    presenter->head = 0;
+    presenter->count = 0;
+    pthread_cond_broadcast(&presenter->space);
+    pthread_mutex_unlock(&presenter->lock);
+}
+
+void presenter_reset_stats(presenter_t *presenter) {
+    pthread_mutex_lock(&presenter->lock);
+    memset(&presenter->stats, 0, sizeof(presenter->stats));
+    pthread_mutex_unlock(&presenter->lock);
+}
+
+void presenter_print_stats(const presenter_t *presenter) {
+    static const char *mode_names[] = {"mailbox", "fifo", "immediate"};
+    if (presenter->stats.presented == 0) {
+        return;
+    }
+    double ms_per_tick = 1000.0 / (double) SDL_GetPerformanceFrequency();
+    printf("Presenter (%s): %llu frames queued, %llu presented, %llu dropped, decode to present avg %.2f ms, "
+           "max %.2f ms\n", mode_names[presenter->mode], (unsigned long long) presenter->stats.pushed,
+           (unsigned long long) presenter->stats.presented, (unsigned long long) presenter->stats.dropped,
+           (double) presenter->stats.latency_ticks * ms_per_tick / (double) presenter->stats.presented,
+           (double) presenter->stats.max_latency_ticks * ms_per_tick);
+}
+
+bool present_mode_parse(const char *value, present_mode_t *mode) {
+    if (value == NULL) {
+        return false;
+    }
+    if (strcmp(value, "mailbox") == 0) {
+        *mode = PRESENT_MODE_MAILBOX;
+    } else if (strcmp(value, "fifo") == 0) {
+        *mode = PRESENT_MODE_FIFO;
+    } else if (strcmp(value, "immediate") == 0) {
+        *mode = PRESENT_MODE_IMMEDIATE;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+
+typedef enum present_mode_t {
+    /* Show only the newest frame at vsync, stale frames are dropped */
+    PRESENT_MODE_MAILBOX,
+    /* Queue frames and show one per vsync, smoothest but adds up to queue depth of latency. Decoder waits while the
+     * queue is full, frames are only dropped if presentation stalls */
+    PRESENT_MODE_FIFO,
+    /* Show the newest frame as soon as possible, without vsync. Tears */
+    PRESENT_MODE_IMMEDIATE,
+} present_mode_t;
+
+typedef struct presenter_t presenter_t;
+
+/**
+ * @return NULL if out of memory
+ */
+presenter_t *presenter_create(present_mode_t mode, int fifo_depth);
+
+void presenter_destroy(presenter_t *presenter);
+
+present_mode_t presenter_mode(const presenter_t *presenter);
+
+/**
+ * Queue a decoded frame. Takes over the reference of frame. Called from decoder thread. In FIFO mode, blocks while
+ * the queue is full.
+ */
+void presenter_push(presenter_t *presenter, AVFrame *frame);
+
+/**
+ * Take the next frame to show according to present mode. Called from main thread.
+ *
+ * @param frame Receives the reference of the frame
+ * @return false if there is nothing new to show
+ */
+bool presenter_acquire(presenter_t *presenter, AVFrame *frame);
+
+/**
+ * Frame from last presenter_acquire() is now on screen.
+ */
+void presenter_presented(presenter_t *presenter);
+
+/**
+ * Drop all queued frames, e.g. when the stream is suspended.
+ */
+void presenter_flush(presenter_t *presenter);
+
+void presenter_reset_stats(presenter_t *presenter);
+
+void presenter_print_stats(const presenter_t *presenter);
+
+bool present_mode_parse(const char *value, present_mode_t *mode);
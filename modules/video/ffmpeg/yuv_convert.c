@@ -0,0 +1,329 @@
+// YUV 4:2:0 to XRGB8888 conversion, for renderers without YUV texture support
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL.h>
+
+#include "yuv_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YUV_CONVERT_X86 1
+
+#include <immintrin.h>
+
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define YUV_CONVERT_NEON 1
+
+#include <arm_neon.h>
+
+#endif
+
+/* Q13 coefficients, products kept in Q5. Matches float matrices within 0.6 LSB, all kernels are bit-exact */
+static const yuv_coefficients_t coefficients[2][2] = {
+        [YUV_MATRIX_BT601] = {
+                {.y_bias = -580, .ky = 9539, .rv = 13075, .gu = -3209, .gv = -6660, .bu = 16525},
+                {.y_bias = 16, .ky = 8192, .rv = 11485, .gu = -2819, .gv = -5850, .bu = 14516},
+        },
+        [YUV_MATRIX_BT709] = {
+                {.y_bias = -580, .ky = 9539, .rv = 14686, .gu = -1747, .gv = -4366, .bu = 17305},
+                {.y_bias = 16, .ky = 8192, .rv = 12901, .gu = -1535, .gv = -3835, .bu = 15201},
+        },
+};
+
+static inline uint8_t clamp_u8(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t) v;
+}
+
+// Same truncation as the SIMD high-half multiplies, so every kernel produces identical output
+static inline int mul_q13(int v, int k) {
+    return (v * k) >> 8;
+}
+
+static inline uint32_t convert_pixel(int y, int d, int e, const yuv_coefficients_t *coef) {
+    int yc = mul_q13(y, coef->ky) + coef->y_bias;
+    uint8_t r = clamp_u8((yc + mul_q13(e, coef->rv)) >> 5);
+    uint8_t g = clamp_u8((yc + mul_q13(d, coef->gu) + mul_q13(e, coef->gv)) >> 5);
+    uint8_t b = clamp_u8((yc + mul_q13(d, coef->bu)) >> 5);
+    return 0xFF000000u | (uint32_t) r << 16 | (uint32_t) g << 8 | b;
+}
+
+static void convert_row_scalar_from(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool uv_interleaved,
+                                    uint32_t *dst, int start, int width, const yuv_coefficients_t *coef) {
+    for (int x = start; x < width; x++) {
+        int cx = x / 2;
+        int d, e;
+        if (uv_interleaved) {
+            d = u[cx * 2] - 128;
+            e = u[cx * 2 + 1] - 128;
+        } else {
+            d = u[cx] - 128;
+            e = v[cx] - 128;
+        }
+        dst[x] = convert_pixel(y[x], d, e, coef);
+    }
+}
+
+static void convert_row_scalar(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool uv_interleaved,
+                               uint32_t *dst, int width, const yuv_coefficients_t *coef) {
+    convert_row_scalar_from(y, u, v, uv_interleaved, dst, 0, width, coef);
+}
+
+#if YUV_CONVERT_X86
+
+__attribute__((target("sse2")))
+static void convert_row_sse2(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool uv_interleaved,
+                             uint32_t *dst, int width, const yuv_coefficients_t *coef) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8((char) 0xFF);
+    const __m128i chroma_bias = _mm_set1_epi16(128);
+    const __m128i y_bias = _mm_set1_epi16(coef->y_bias);
+    const __m128i ky = _mm_set1_epi16(coef->ky), rv = _mm_set1_epi16(coef->rv), gu = _mm_set1_epi16(coef->gu),
+            gv = _mm_set1_epi16(coef->gv), bu = _mm_set1_epi16(coef->bu);
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i d, e;
+        if (uv_interleaved) {
+            __m128i uv = _mm_loadu_si128((const __m128i *) (u + x));
+            d = _mm_and_si128(uv, low_bytes);
+            e = _mm_srli_epi16(uv, 8);
+        } else {
+            d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (u + x / 2)), zero);
+            e = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (v + x / 2)), zero);
+        }
+        // Scaled by 256 so the high half of the product is (d * k) >> 8
+        d = _mm_slli_epi16(_mm_sub_epi16(d, chroma_bias), 8);
+        e = _mm_slli_epi16(_mm_sub_epi16(e, chroma_bias), 8);
+        __m128i rc = _mm_mulhi_epi16(e, rv);
+        __m128i gc = _mm_add_epi16(_mm_mulhi_epi16(d, gu), _mm_mulhi_epi16(e, gv));
+        __m128i bc = _mm_mulhi_epi16(d, bu);
+
+        // Unpacking luma into the high byte scales it by 256 as well
+        __m128i yv = _mm_loadu_si128((const __m128i *) (y + x));
+        __m128i y_lo = _mm_unpacklo_epi8(zero, yv), y_hi = _mm_unpackhi_epi8(zero, yv);
+        y_lo = _mm_add_epi16(_mm_mulhi_epu16(y_lo, ky), y_bias);
+        y_hi = _mm_add_epi16(_mm_mulhi_epu16(y_hi, ky), y_bias);
+
+        // Each chroma sample covers two horizontal pixels
+        __m128i r = _mm_packus_epi16(_mm_srai_epi16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(rc, rc)), 5),
+                                     _mm_srai_epi16(_mm_adds_epi16(y_hi, _mm_unpackhi_epi16(rc, rc)), 5));
+        __m128i g = _mm_packus_epi16(_mm_srai_epi16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(gc, gc)), 5),
+                                     _mm_srai_epi16(_mm_adds_epi16(y_hi, _mm_unpackhi_epi16(gc, gc)), 5));
+        __m128i b = _mm_packus_epi16(_mm_srai_epi16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(bc, bc)), 5),
+                                     _mm_srai_epi16(_mm_adds_epi16(y_hi, _mm_unpackhi_epi16(bc, bc)), 5));
+
+        __m128i bg_lo = _mm_unpacklo_epi8(b, g), bg_hi = _mm_unpackhi_epi8(b, g);
+        __m128i ra_lo = _mm_unpacklo_epi8(r, alpha), ra_hi = _mm_unpackhi_epi8(r, alpha);
+        __m128i *out = (__m128i *) (dst + x);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(bg_lo, ra_lo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bg_lo, ra_lo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bg_hi, ra_hi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bg_hi, ra_hi));
+    }
+    convert_row_scalar_from(y, u, v, uv_interleaved, dst, x, width, coef);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_channel(__m256i y_lo, __m256i y_hi, __m256i c) {
+    // c holds chroma of 32 pixels in qword order 0,2,1,3, so in-lane unpack duplicates them in pixel order
+    __m256i lo = _mm256_srai_epi16(_mm256_adds_epi16(y_lo, _mm256_unpacklo_epi16(c, c)), 5);
+    __m256i hi = _mm256_srai_epi16(_mm256_adds_epi16(y_hi, _mm256_unpackhi_epi16(c, c)), 5);
+    // Lane 0 gets pixels 0-7 and 16-23, lane 1 gets 8-15 and 24-31
+    return _mm256_packus_epi16(lo, hi);
+}
+
+__attribute__((target("avx2")))
+static void convert_row_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool uv_interleaved,
+                             uint32_t *dst, int width, const yuv_coefficients_t *coef) {
+    const __m256i alpha = _mm256_set1_epi8((char) 0xFF);
+    const __m256i chroma_bias = _mm256_set1_epi16(128);
+    const __m256i y_bias = _mm256_set1_epi16(coef->y_bias);
+    const __m256i ky = _mm256_set1_epi16(coef->ky), rv = _mm256_set1_epi16(coef->rv),
+            gu = _mm256_set1_epi16(coef->gu), gv = _mm256_set1_epi16(coef->gv), bu = _mm256_set1_epi16(coef->bu);
+    const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i d, e;
+        if (uv_interleaved) {
+            __m256i uv = _mm256_loadu_si256((const __m256i *) (u + x));
+            d = _mm256_and_si256(uv, low_bytes);
+            e = _mm256_srli_epi16(uv, 8);
+        } else {
+            d = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (u + x / 2)));
+            e = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (v + x / 2)));
+        }
+        d = _mm256_slli_epi16(_mm256_sub_epi16(d, chroma_bias), 8);
+        e = _mm256_slli_epi16(_mm256_sub_epi16(e, chroma_bias), 8);
+        d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(3, 1, 2, 0));
+        e = _mm256_permute4x64_epi64(e, _MM_SHUFFLE(3, 1, 2, 0));
+        __m256i rc = _mm256_mulhi_epi16(e, rv);
+        __m256i gc = _mm256_add_epi16(_mm256_mulhi_epi16(d, gu), _mm256_mulhi_epi16(e, gv));
+        __m256i bc = _mm256_mulhi_epi16(d, bu);
+
+        __m256i y_lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (y + x)));
+        __m256i y_hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (y + x + 16)));
+        y_lo = _mm256_add_epi16(_mm256_mulhi_epu16(_mm256_slli_epi16(y_lo, 8), ky), y_bias);
+        y_hi = _mm256_add_epi16(_mm256_mulhi_epu16(_mm256_slli_epi16(y_hi, 8), ky), y_bias);
+
+        __m256i r = avx2_channel(y_lo, y_hi, rc);
+        __m256i g = avx2_channel(y_lo, y_hi, gc);
+        __m256i b = avx2_channel(y_lo, y_hi, bc);
+
+        // Lane 0: pixels 0-7, lane 1: pixels 8-15
+        __m256i bg_lo = _mm256_unpacklo_epi8(b, g), ra_lo = _mm256_unpacklo_epi8(r, alpha);
+        // Lane 0: pixels 16-23, lane 1: pixels 24-31
+        __m256i bg_hi = _mm256_unpackhi_epi8(b, g), ra_hi = _mm256_unpackhi_epi8(r, alpha);
+        __m256i p0 = _mm256_unpacklo_epi16(bg_lo, ra_lo), p1 = _mm256_unpackhi_epi16(bg_lo, ra_lo);
+        __m256i p2 = _mm256_unpacklo_epi16(bg_hi, ra_hi), p3 = _mm256_unpackhi_epi16(bg_hi, ra_hi);
+        __m256i *out = (__m256i *) (dst + x);
+        _mm256_storeu_si256(out, _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+    convert_row_scalar_from(y, u, v, uv_interleaved, dst, x, width, coef);
+}
+
+#endif
+
+#if YUV_CONVERT_NEON
+
+static inline uint8x16_t neon_channel(int16x8_t y_lo, int16x8_t y_hi, int16x8_t c) {
+    int16x8x2_t dup = vzipq_s16(c, c);
+    return vcombine_u8(vqmovun_s16(vshrq_n_s16(vqaddq_s16(y_lo, dup.val[0]), 5)),
+                       vqmovun_s16(vshrq_n_s16(vqaddq_s16(y_hi, dup.val[1]), 5)));
+}
+
+static void convert_row_neon(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool uv_interleaved,
+                             uint32_t *dst, int width, const yuv_coefficients_t *coef) {
+    const int16x8_t chroma_bias = vdupq_n_s16(128);
+    const int16x8_t y_bias = vdupq_n_s16(coef->y_bias);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x8_t u8, v8;
+        if (uv_interleaved) {
+            uint8x8x2_t uv = vld2_u8(u + x);
+            u8 = uv.val[0];
+            v8 = uv.val[1];
+        } else {
+            u8 = vld1_u8(u + x / 2);
+            v8 = vld1_u8(v + x / 2);
+        }
+        // Doubling high-half multiply of values scaled by 128 gives (d * k) >> 8, same as the x86 kernels
+        int16x8_t d = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), chroma_bias), 7);
+        int16x8_t e = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), chroma_bias), 7);
+        int16x8_t rc = vqdmulhq_n_s16(e, coef->rv);
+        int16x8_t gc = vaddq_s16(vqdmulhq_n_s16(d, coef->gu), vqdmulhq_n_s16(e, coef->gv));
+        int16x8_t bc = vqdmulhq_n_s16(d, coef->bu);
+
+        uint8x16_t yv = vld1q_u8(y + x);
+        int16x8_t y_lo = vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(yv), 7));
+        int16x8_t y_hi = vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(yv), 7));
+        y_lo = vaddq_s16(vqdmulhq_n_s16(y_lo, coef->ky), y_bias);
+        y_hi = vaddq_s16(vqdmulhq_n_s16(y_hi, coef->ky), y_bias);
+
+        uint8x16x4_t bgra;
+        bgra.val[0] = neon_channel(y_lo, y_hi, bc);
+        bgra.val[1] = neon_channel(y_lo, y_hi, gc);
+        bgra.val[2] = neon_channel(y_lo, y_hi, rc);
+        bgra.val[3] = vdupq_n_u8(0xFF);
+        vst4q_u8((uint8_t *) (dst + x), bgra);
+    }
+    convert_row_scalar_from(y, u, v, uv_interleaved, dst, x, width, coef);
+}
+
+#endif
+
+static const yuv_converter_t converter_scalar = {"scalar", convert_row_scalar};
+#if YUV_CONVERT_X86
+static const yuv_converter_t converter_sse2 = {"sse2", convert_row_sse2};
+static const yuv_converter_t converter_avx2 = {"avx2", convert_row_avx2};
+#endif
+#if YUV_CONVERT_NEON
+static const yuv_converter_t converter_neon = {"neon", convert_row_neon};
+#endif
+
+const yuv_coefficients_t *yuv_coefficients(yuv_matrix_t matrix, bool full_range) {
+    return &coefficients[matrix][full_range ? 1 : 0];
+}
+
+const yuv_converter_t *yuv_converter_select() {
+#if YUV_CONVERT_X86
+    if (SDL_HasAVX2()) {
+        return &converter_avx2;
+    }
+    if (SDL_HasSSE2()) {
+        return &converter_sse2;
+    }
+#endif
+#if YUV_CONVERT_NEON
+    if (SDL_HasNEON()) {
+        return &converter_neon;
+    }
+#endif
+    return &converter_scalar;
+}
+
+void yuv_convert_frame(const yuv_converter_t *converter, const yuv_coefficients_t *coef,
+                       const uint8_t *y, int y_stride, const uint8_t *u, int u_stride, const uint8_t *v, int v_stride,
+                       uint8_t *dst, int dst_stride, int width, int height) {
+    bool uv_interleaved = v == NULL;
+    for (int row = 0; row < height; row++) {
+        int chroma_row = row / 2;
+        converter->row(y + row * y_stride, u + chroma_row * u_stride,
+                       uv_interleaved ? NULL : v + chroma_row * v_stride, uv_interleaved,
+                       (uint32_t *) (dst + row * dst_stride), width, coef);
+    }
+}
+
+void yuv_convert_benchmark() {
+    static const struct {
+        int width, height;
+    } resolutions[] = {{1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}};
+    const yuv_converter_t *converters[4];
+    int num_converters = 0;
+    converters[num_converters++] = &converter_scalar;
+#if YUV_CONVERT_X86
+    if (SDL_HasSSE2()) {
+        converters[num_converters++] = &converter_sse2;
+    }
+    if (SDL_HasAVX2()) {
+        converters[num_converters++] = &converter_avx2;
+    }
+#endif
+#if YUV_CONVERT_NEON
+    if (SDL_HasNEON()) {
+        converters[num_converters++] = &converter_neon;
+    }
+#endif
+    const int iterations = 20;
+    const yuv_coefficients_t *coef = yuv_coefficients(YUV_MATRIX_BT709, false);
+    printf("YUV to RGB conversion, ms per frame (I420 / NV12)\n");
+    for (int r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+        int width = resolutions[r].width, height = resolutions[r].height;
+        size_t luma_size = (size_t) width * height;
+        uint8_t *yuv = malloc(luma_size * 3 / 2);
+        uint8_t *rgb = malloc(luma_size * 4);
+        for (size_t i = 0; i < luma_size * 3 / 2; i++) {
+            yuv[i] = (uint8_t) (i * 7 + i / width);
+        }
+        const uint8_t *u = yuv + luma_size, *v = u + luma_size / 4;
+        for (int c = 0; c < num_converters; c++) {
+            double ms[2];
+            for (int nv12 = 0; nv12 <= 1; nv12++) {
+                Uint64 begin = SDL_GetPerformanceCounter();
+                for (int i = 0; i < iterations; i++) {
+                    yuv_convert_frame(converters[c], coef, yuv, width, u, nv12 ? width : width / 2,
+                                      nv12 ? NULL : v, width / 2, rgb, width * 4, width, height);
+                }
+                ms[nv12] = (double) (SDL_GetPerformanceCounter() - begin) * 1000.0 /
+                           (double) SDL_GetPerformanceFrequency() / iterations;
+            }
+            printf("  %4dx%-4d %-6s %7.3f / %7.3f\n", width, height, converters[c]->name, ms[0], ms[1]);
+        }
+        free(rgb);
+        free(yuv);
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Fixed point (Q13) YUV to RGB coefficients. Kept in 16 bits so SIMD kernels can work on 8 or 16 pixels at a time.
+ * y_bias folds the limited range offset and rounding into one Q5 term.
+ */
+typedef struct yuv_coefficients_t {
+    int16_t y_bias;
+    int16_t ky;
+    int16_t rv, gu, gv, bu;
+} yuv_coefficients_t;
+
+typedef enum yuv_matrix_t {
+    YUV_MATRIX_BT601,
+    YUV_MATRIX_BT709,
+} yuv_matrix_t;
+
+/**
+ * Convert one row of pixels to XRGB8888.
+ *
+ * @param u U plane row, or interleaved UV row when uv_interleaved is set (NV12)
+ * @param v V plane row, ignored when uv_interleaved is set
+ */
+typedef void (*yuv_convert_row_fn)(const uint8_t *y, const uint8_t *u, const uint8_t *v, bool uv_interleaved,
+                                   uint32_t *dst, int width, const yuv_coefficients_t *coef);
+
+typedef struct yuv_converter_t {
+    const char *name;
+    yuv_convert_row_fn row;
+} yuv_converter_t;
+
+const yuv_coefficients_t *yuv_coefficients(yuv_matrix_t matrix, bool full_range);
+
+/**
+ * Pick the fastest kernel supported by the running CPU.
+ */
+const yuv_converter_t *yuv_converter_select();
+
+/**
+ * Convert a 4:2:0 frame to XRGB8888.
+ *
+ * @param u_stride Stride of U plane, or interleaved UV plane if v is NULL
+ */
+void yuv_convert_frame(const yuv_converter_t *converter, const yuv_coefficients_t *coef,
+                       const uint8_t *y, int y_stride, const uint8_t *u, int u_stride, const uint8_t *v, int v_stride,
+                       uint8_t *dst, int dst_stride, int width, int height);
+
+/**
+ * Print conversion cost per frame of every kernel available on this CPU, at common stream resolutions.
+ */
+void yuv_convert_benchmark();
@@ -5,14 +5,13 @@
 
 static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context);
 
-static int audio_submit(IHS_Session *session, const uint8_t *data, size_t dataLen, void *context);
+static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context);
 
 static void audio_stop(IHS_Session *session, void *context);
 
 static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context);
 
-static int video_submit(IHS_Session *session, const uint8_t *data, size_t dataLen, uint16_t sequence,
-                        IHS_StreamVideoFrameFlag flags, void *context);
+static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context);
 
 static void video_stop(IHS_Session *session, void *context);
 
@@ -28,22 +27,28 @@ static const IHS_StreamVideoCallbacks video_callbacks = {
         .stop = video_stop,
 };
 
-void module_init(int argc, char *argv[]) {
+static void ndl_init(int argc, char *argv[]) {
     NDL_DirectMediaInit(getenv("APPID"), NULL);
 }
 
-void module_post_init(int argc, char *argv[]) {
-
-}
-
-const IHS_StreamAudioCallbacks *module_audio_callbacks() {
+static const IHS_StreamAudioCallbacks *ndl_audio_callbacks() {
     return &audio_callbacks;
 }
 
-const IHS_StreamVideoCallbacks *module_video_callbacks() {
+static const IHS_StreamVideoCallbacks *ndl_video_callbacks() {
     return &video_callbacks;
 }
 
+IHSPLAY_MODULE_EXPORT const ihsplay_module_t ihsplay_module = {
+        .name = "ndl",
+        // Loading fails on systems whose NDL lacks the v1 audio and video API, nothing else to check
+        .probe = NULL,
+        .init = ndl_init,
+        .audio = ndl_audio_callbacks,
+        .video = ndl_video_callbacks,
+        // Video is on a hardware plane below the UI
+};
+
 static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context) {
     NDL_DIRECTAUDIO_DATA_INFO info = {
             .numChannel = config->channels,
@@ -58,8 +63,8 @@ static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config
     return NDL_DirectAudioOpen(&info);
 }
 
-static int audio_submit(IHS_Session *session, const uint8_t *data, size_t dataLen, void *context) {
-    return NDL_DirectAudioPlay(data, dataLen, 0);
+static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context) {
+    return NDL_DirectAudioPlay(IHS_BufferPointer(data), data->size, 0);
 }
 
 static void audio_stop(IHS_Session *session, void *context) {
@@ -74,9 +79,8 @@ static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config
     return NDL_DirectVideoOpen(&info);
 }
 
-static int video_submit(IHS_Session *session, const uint8_t *data, size_t dataLen, uint16_t sequence,
-                        IHS_StreamVideoFrameFlag flags, void *context) {
-    return NDL_DirectVideoPlay(data, dataLen, 0);
+static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context) {
+    return NDL_DirectVideoPlay(IHS_BufferPointer(data), data->size, 0);
 }
 
 static void video_stop(IHS_Session *session, void *context) {
@@ -0,0 +1,90 @@
+#include "media_clock.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Assumed until arrivals tell otherwise */
+#define DEFAULT_FRAME_INTERVAL_US 16667
+/* Arrivals further off than this many frame intervals restart the video timeline */
+#define VIDEO_RESYNC_FRAMES 3
+/* Sample clock and arrival time further apart than this restart the audio timeline */
+#define AUDIO_RESYNC_US 100000
+
+void media_clock_reset(media_clock_t *clock, long long now_us) {
+    memset(clock, 0, sizeof(media_clock_t));
+    clock->epoch_us = now_us;
+    clock->video_interval = DEFAULT_FRAME_INTERVAL_US;
+}
+
+long long media_clock_video_pts(media_clock_t *clock, long long now_us) {
+    long long arrival = now_us - clock->epoch_us;
+    long long pts;
+    if (!clock->video_started) {
+        clock->video_started = true;
+        pts = arrival;
+    } else {
+        long long delta = arrival - clock->video_last_pts;
+        if (delta > 0 && delta < clock->video_interval * VIDEO_RESYNC_FRAMES) {
+            clock->video_interval += (delta - clock->video_interval) / 16;
+        }
+        long long expected = clock->video_last_pts + clock->video_interval;
+        long long error = arrival - expected;
+        if (error > clock->video_interval * VIDEO_RESYNC_FRAMES || error < -clock->video_interval * VIDEO_RESYNC_FRAMES) {
+            clock->stats.video_resyncs++;
+            pts = arrival;
+        } else {
+            // Stay on the frame grid, and follow arrivals slowly so network jitter doesn't reach the display
+            pts = expected + error / 8;
+        }
+        if (pts <= clock->video_last_pts) {
+            pts = clock->video_last_pts + 1;
+        }
+    }
+    clock->video_last_pts = pts;
+    clock->video_offset = pts - arrival;
+    if (clock->audio_started) {
+        long long gap = clock->video_offset - clock->audio_offset;
+        if (gap < 0) {
+            gap = -gap;
+        }
+        clock->stats.gap_samples++;
+        clock->stats.gap_sum += gap;
+        if (gap > clock->stats.gap_max) {
+            clock->stats.gap_max = gap;
+        }
+    }
+    return pts;
+}
+
+long long media_clock_audio_pts(media_clock_t *clock, long long now_us, uint32_t samples, uint32_t rate) {
+    long long arrival = now_us - clock->epoch_us;
+    if (!clock->audio_started || rate != clock->audio_rate) {
+        clock->audio_started = true;
+        clock->audio_rate = rate;
+        clock->audio_base_pts = arrival;
+        clock->audio_samples = 0;
+    }
+    long long pts = clock->audio_base_pts + (long long) (clock->audio_samples * 1000000 / rate);
+    if (samples == 0 || pts - arrival > AUDIO_RESYNC_US || arrival - pts > AUDIO_RESYNC_US) {
+        if (samples != 0 && clock->audio_samples != 0) {
+            clock->stats.audio_resyncs++;
+        }
+        // Continue from where the previous timeline ended, so timestamps never go backwards
+        clock->audio_base_pts = pts > arrival ? pts : arrival;
+        clock->audio_samples = 0;
+        pts = clock->audio_base_pts;
+    }
+    clock->audio_samples += samples;
+    clock->audio_offset = pts - arrival;
+    return pts;
+}
+
+void media_clock_print_stats(const media_clock_t *clock) {
+    if (clock->stats.gap_samples == 0) {
+        return;
+    }
+    printf("A/V timestamps: gap avg %.2f ms, max %.2f ms, frame interval %.2f ms, %llu video and %llu audio resyncs\n",
+           (double) clock->stats.gap_sum / 1000.0 / (double) clock->stats.gap_samples,
+           (double) clock->stats.gap_max / 1000.0, (double) clock->video_interval / 1000.0,
+           (unsigned long long) clock->stats.video_resyncs, (unsigned long long) clock->stats.audio_resyncs);
+}
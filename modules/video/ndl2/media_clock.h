@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Generates monotonic presentation timestamps (in microseconds from session start) for both streams.
+ *
+ * Video follows frame arrival, smoothed to the frame interval estimated from arrivals. Audio follows decoded sample
+ * count, and is rebased on arrival time when the two drift too far apart (e.g. after packet loss).
+ */
+typedef struct media_clock_t {
+    long long epoch_us;
+    bool video_started, audio_started;
+    long long video_last_pts, video_interval;
+    long long audio_base_pts;
+    uint64_t audio_samples;
+    uint32_t audio_rate;
+    /* PTS minus arrival time of the latest stamp of each stream */
+    long long video_offset, audio_offset;
+
+    struct {
+        uint64_t gap_samples;
+        long long gap_sum;
+        long long gap_max;
+        uint64_t video_resyncs;
+        uint64_t audio_resyncs;
+    } stats;
+} media_clock_t;
+
+void media_clock_reset(media_clock_t *clock, long long now_us);
+
+long long media_clock_video_pts(media_clock_t *clock, long long now_us);
+
+/**
+ * @param samples Samples per channel in this packet, 0 if unknown
+ */
+long long media_clock_audio_pts(media_clock_t *clock, long long now_us, uint32_t samples, uint32_t rate);
+
+void media_clock_print_stats(const media_clock_t *clock);
@@ -1,8 +1,20 @@
 #include "module.h"
+#include "audio_packet.h"
+#include "backpressure.h"
+#include "media_clock.h"
+#include "param_cache.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <NDL_directmedia_v2.h>
 #include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Longest time to wait for the other stream to start before loading with what we have */
+#define MEDIA_LOAD_DEADLINE_MS 300
+/* media_clock works in microseconds, NDL takes nanoseconds */
+#define NDL_PTS_PER_US 1000LL
 
 static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context);
 
@@ -16,12 +28,59 @@ static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoF
 
 static void video_stop(IHS_Session *session, void *context);
 
+static int video_play(IHS_Buffer *data, bool has_params, long long pts);
+
 static void media_unload();
 
-static int media_reload();
+static void media_load_callback(int type, long long numValue, const char *strValue);
+
+static int media_stream_started(bool *configured);
+
+static int media_load();
+
+static bool media_load_due();
+
+static bool media_init();
+
+static int media_failure_result();
+
+static void media_release();
+
+static long media_ticks_ms();
+
+static long long media_ticks_us();
+
+static long long media_arrival_us(long long *arrival);
+
+/* Receive times of the packets being submitted, set by the stream workers. 0 if submit runs on the receive thread */
+static long long audio_arrival_us = 0, video_arrival_us = 0;
 
 static bool media_initialized = false;
 static bool media_loaded = false;
+/* Set when a load failed, so packets don't retry it. Cleared by anything that changes what would be loaded */
+static bool media_load_failed = false, media_failure_reported = false;
+
+/* Guards media state against module_suspend()/module_resume() coming from the main thread */
+static pthread_mutex_t media_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool media_suspended = false;
+static bool video_need_keyframe = false, video_keyframe_requested = false;
+static long resume_ticks = 0;
+
+/* Audio and video configs are collected, and the pipeline is loaded once with both */
+static int media_refs = 0;
+static bool audio_configured = false, video_configured = false;
+static long media_start_ticks = 0;
+static int media_load_count = 0;
+
+static media_clock_t media_clock;
+static backpressure_t video_backpressure;
+/* Parameter sets go in front of the first frame after a load, unless that frame has its own */
+static param_cache_t video_params;
+static bool video_inject_params = false;
+static uint8_t *video_inject_buffer = NULL;
+static size_t video_inject_capacity = 0;
+static IHS_StreamAudioCodec audio_codec;
+static uint32_t audio_frequency = 0;
 
 static NDL_DIRECTMEDIA_DATA_INFO media_info = {
         .audio.type = 0,
@@ -40,26 +99,85 @@ static const IHS_StreamVideoCallbacks video_callbacks = {
         .stop = video_stop,
 };
 
-void module_init(int argc, char *argv[]) {
+static void ndl_prewarm() {
+    pthread_mutex_lock(&media_lock);
+    // Session ends with NDL_DirectMediaQuit, so this runs for every session, not just the first
+    media_init();
+    pthread_mutex_unlock(&media_lock);
 }
 
-void module_post_init(int argc, char *argv[]) {
-    if (NDL_DirectMediaInit(getenv("APPID"), NULL) == 0) {
-        media_initialized = true;
-    } else {
-        media_initialized = false;
+static void ndl_deinit() {
+    pthread_mutex_lock(&media_lock);
+    // Pre-warmed NDL no session took over
+    if (media_refs == 0) {
+        media_unload();
     }
+    pthread_mutex_unlock(&media_lock);
 }
 
-const IHS_StreamAudioCallbacks *module_audio_callbacks() {
+static void ndl_audio_arrival(long long us) {
+    audio_arrival_us = us;
+}
+
+static void ndl_video_arrival(long long us) {
+    video_arrival_us = us;
+}
+
+static const IHS_StreamAudioCallbacks *ndl_audio_callbacks() {
     return &audio_callbacks;
 }
 
-const IHS_StreamVideoCallbacks *module_video_callbacks() {
+static const IHS_StreamVideoCallbacks *ndl_video_callbacks() {
     return &video_callbacks;
 }
 
+static void ndl_suspend() {
+    pthread_mutex_lock(&media_lock);
+    // Also before the deferred load, so it doesn't happen in the background
+    if (media_refs > 0 && !media_suspended) {
+        if (media_loaded) {
+            // Keep NDL initialized and media_info intact, so resume only needs a load
+            NDL_DirectMediaUnload();
+            media_loaded = false;
+        }
+        media_suspended = true;
+        printf("Media pipeline suspended\n");
+    }
+    pthread_mutex_unlock(&media_lock);
+}
+
+static void ndl_resume() {
+    pthread_mutex_lock(&media_lock);
+    if (media_suspended) {
+        media_suspended = false;
+        media_load_failed = false;
+        // A load that isn't due yet is left to the next packet, as before suspending
+        if (media_load_due() && media_load() == 0) {
+            video_need_keyframe = true;
+            video_keyframe_requested = false;
+        }
+    }
+    pthread_mutex_unlock(&media_lock);
+}
+
+IHSPLAY_MODULE_EXPORT const ihsplay_module_t ihsplay_module = {
+        .name = "ndl2",
+        // Loading fails on systems whose NDL lacks the v2 media API, nothing else to check
+        .probe = NULL,
+        .prewarm = ndl_prewarm,
+        .deinit = ndl_deinit,
+        .audio = ndl_audio_callbacks,
+        .audio_arrival = ndl_audio_arrival,
+        .video = ndl_video_callbacks,
+        .video_arrival = ndl_video_arrival,
+        .suspend = ndl_suspend,
+        .resume = ndl_resume,
+        // Video is on a hardware plane below the UI
+};
+
 static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context) {
+    // A load from the video worker may read media_info at any time
+    pthread_mutex_lock(&media_lock);
     switch (config->codec) {
         case IHS_StreamAudioCodecMP3:
             media_info.audio.type = NDL_AUDIO_TYPE_MP3;
@@ -70,21 +188,56 @@ static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config
             media_info.audio.opus.sampleRate = (double) config->frequency / 1000.0f;
             break;
         default: {
+            pthread_mutex_unlock(&media_lock);
             return -1;
         }
     }
-    return media_reload();
+    audio_codec = config->codec;
+    audio_frequency = config->frequency;
+    int ret = media_stream_started(&audio_configured);
+    if (ret != 0) {
+        media_info.audio.type = 0;
+    }
+    pthread_mutex_unlock(&media_lock);
+    return ret;
 }
 
 static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context) {
-    return NDL_DirectAudioPlay(IHS_BufferPointer(data), data->size, 0);
+    // Taken even if the packet goes nowhere, so it doesn't stick to the next one
+    long long arrival = media_arrival_us(&audio_arrival_us);
+    pthread_mutex_lock(&media_lock);
+    int ret = 0;
+    if (media_load_due()) {
+        media_load();
+    }
+    if (media_load_failed) {
+        ret = media_failure_result();
+    } else if (media_loaded) {
+        uint8_t *ptr = IHS_BufferPointer(data);
+        uint32_t samples;
+        if (audio_codec == IHS_StreamAudioCodecOpus) {
+            samples = opus_packet_samples(ptr, data->size, audio_frequency);
+        } else {
+            samples = mp3_frame_samples(ptr, data->size);
+        }
+        long long pts = media_clock_audio_pts(&media_clock, arrival, samples, audio_frequency);
+        ret = NDL_DirectAudioPlay(ptr, data->size, pts * NDL_PTS_PER_US);
+    }
+    pthread_mutex_unlock(&media_lock);
+    return ret;
 }
 
 static void audio_stop(IHS_Session *session, void *context) {
-    media_unload();
+    pthread_mutex_lock(&media_lock);
+    audio_configured = false;
+    media_info.audio.type = 0;
+    media_release();
+    pthread_mutex_unlock(&media_lock);
 }
 
 static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context) {
+    // A load from the audio worker may read media_info at any time
+    pthread_mutex_lock(&media_lock);
     switch (config->codec) {
         case IHS_StreamVideoCodecH264:
             media_info.video.type = NDL_VIDEO_TYPE_H264;
@@ -96,21 +249,102 @@ static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config
             media_info.video.type = NDL_VIDEO_TYPE_VP9;
             break;
         default: {
+            pthread_mutex_unlock(&media_lock);
             return -1;
         }
     }
     media_info.video.width = (int) config->width;
     media_info.video.height = (int) config->height;
     media_info.video.unknown1 = 0;
-    return media_reload();
+    backpressure_init(&video_backpressure, config->codec);
+    param_cache_init(&video_params, config->codec);
+    int ret = media_stream_started(&video_configured);
+    if (ret != 0) {
+        media_info.video.type = 0;
+    }
+    pthread_mutex_unlock(&media_lock);
+    return ret;
 }
 
 static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context) {
-    return NDL_DirectVideoPlay(IHS_BufferPointer(data), data->size, 0);
+    long long arrival = media_arrival_us(&video_arrival_us);
+    pthread_mutex_lock(&media_lock);
+    int ret = DR_OK;
+    bool keyframe = flags & IHS_StreamVideoFrameKeyFrame;
+    // Learn parameter sets even while nothing is loaded, the first frame after a load may need them
+    bool has_params = param_cache_update(&video_params, IHS_BufferPointer(data), data->size);
+    if (media_load_due()) {
+        media_load();
+    }
+    if (media_load_failed) {
+        ret = media_failure_result();
+    } else if (media_suspended) {
+        // Nothing to decode into. Key frame will be requested on resume
+    } else if (!media_loaded) {
+        // Still waiting for audio config, decoding has to start from a key frame once loaded
+        if (!video_need_keyframe) {
+            video_need_keyframe = true;
+            video_keyframe_requested = false;
+        }
+    } else if (video_need_keyframe && !keyframe && !param_cache_can_resume(&video_params)) {
+        // Ask only once, the host will send an IDR shortly
+        if (!video_keyframe_requested) {
+            video_keyframe_requested = true;
+            ret = DR_NEED_IDR;
+        }
+    } else if (backpressure_admit(&video_backpressure, data, flags, false, &ret)) {
+        if (video_need_keyframe) {
+            video_need_keyframe = false;
+            if (!keyframe) {
+                // Frame has a recovery point, cached parameter sets are enough to start
+                video_params.stats.idr_avoided++;
+            }
+            printf("Media pipeline ready, first %s after %ld ms\n", keyframe ? "key frame" : "frame without IDR",
+                   media_ticks_ms() - resume_ticks);
+        }
+        long long pts = media_clock_video_pts(&media_clock, arrival);
+        if (video_play(data, has_params, pts * NDL_PTS_PER_US) != 0) {
+            // Pipeline refused the frame, most likely its queue is full
+            ret = backpressure_lost(&video_backpressure, data);
+        } else {
+            video_inject_params = false;
+        }
+    }
+    pthread_mutex_unlock(&media_lock);
+    return ret;
 }
 
 static void video_stop(IHS_Session *session, void *context) {
-    media_unload();
+    pthread_mutex_lock(&media_lock);
+    video_configured = false;
+    media_info.video.type = 0;
+    backpressure_print_stats(&video_backpressure);
+    param_cache_print_stats(&video_params);
+    free(video_inject_buffer);
+    video_inject_buffer = NULL;
+    video_inject_capacity = 0;
+    media_release();
+    pthread_mutex_unlock(&media_lock);
+}
+
+static int video_play(IHS_Buffer *data, bool has_params, long long pts) {
+    size_t params_size = video_inject_params && !has_params ? param_cache_size(&video_params) : 0;
+    if (params_size == 0) {
+        return NDL_DirectVideoPlay(IHS_BufferPointer(data), data->size, pts);
+    }
+    // NDL takes one contiguous buffer, so parameter sets and frame are copied together
+    size_t size = params_size + data->size;
+    if (size > video_inject_capacity) {
+        uint8_t *buffer = realloc(video_inject_buffer, size);
+        if (buffer == NULL) {
+            return NDL_DirectVideoPlay(IHS_BufferPointer(data), data->size, pts);
+        }
+        video_inject_buffer = buffer;
+        video_inject_capacity = size;
+    }
+    param_cache_write(&video_params, video_inject_buffer, params_size);
+    IHS_BufferReadMem(data, 0, video_inject_buffer + params_size, data->size);
+    return NDL_DirectVideoPlay(video_inject_buffer, size, pts);
 }
 
 static void media_load_callback(int type, long long numValue, const char *strValue) {
@@ -118,6 +352,9 @@ static void media_load_callback(int type, long long numValue, const char *strVal
 }
 
 static void media_unload() {
+    media_suspended = false;
+    media_load_failed = false;
+    video_need_keyframe = false;
     if (media_loaded) {
         NDL_DirectMediaUnload();
         media_loaded = false;
@@ -128,13 +365,116 @@ static void media_unload() {
     }
 }
 
-static int media_reload() {
-    media_unload();
+/**
+ * Takes a reference on the pipeline only if it succeeds, ihslib doesn't call stop after a failed start.
+ */
+static int media_stream_started(bool *configured) {
+    bool first = media_refs == 0;
+    if (first) {
+        media_start_ticks = media_ticks_ms();
+        media_load_count = 0;
+        media_clock_reset(&media_clock, media_ticks_us());
+    }
+    *configured = true;
+    // Config changed, so a load is worth trying again
+    media_load_failed = false;
+    int ret = 0;
+    if (media_suspended) {
+        // Resume loads with both configs
+    } else if (media_loaded) {
+        // Stream came after the deadline, pipeline has to be loaded again to include it
+        NDL_DirectMediaUnload();
+        media_loaded = false;
+        ret = media_load();
+    } else if (audio_configured && video_configured) {
+        ret = media_load();
+    }
+    if (ret != 0) {
+        *configured = false;
+        if (first) {
+            media_unload();
+        }
+        return ret;
+    }
+    media_refs++;
+    return 0;
+}
+
+/**
+ * @return Error for the first packet after a failed load, then 0 while nothing is loaded
+ */
+static int media_failure_result() {
+    if (media_failure_reported) {
+        return 0;
+    }
+    media_failure_reported = true;
+    return -1;
+}
+
+static bool media_load_due() {
+    if (media_loaded || media_suspended || media_load_failed || media_refs == 0) {
+        return false;
+    }
+    return (audio_configured && video_configured) || media_ticks_ms() - media_start_ticks >= MEDIA_LOAD_DEADLINE_MS;
+}
+
+static bool media_init() {
     if (!media_initialized) {
-        NDL_DirectMediaInit(getenv("APPID"), NULL);
-        media_initialized = true;
+        long begin = media_ticks_ms();
+        media_initialized = NDL_DirectMediaInit(getenv("APPID"), NULL) == 0;
+        printf("NDL initialized in %ld ms\n", media_ticks_ms() - begin);
     }
+    return media_initialized;
+}
+
+static int media_load() {
+    if (!media_init()) {
+        fprintf(stderr, "NDL_DirectMediaInit failed\n");
+        media_load_failed = true;
+        media_failure_reported = false;
+        return -1;
+    }
+    long begin = media_ticks_ms();
     int ret = NDL_DirectMediaLoad(&media_info, media_load_callback);
     media_loaded = ret == 0;
+    video_inject_params = media_loaded;
+    media_load_count++;
+    resume_ticks = media_ticks_ms();
+    printf("Media pipeline loaded (%s%s) %ld ms after first stream start, load took %ld ms, %d load(s) this session\n",
+           audio_configured ? "audio" : "", video_configured ? audio_configured ? "+video" : "video" : "",
+           begin - media_start_ticks, media_ticks_ms() - begin, media_load_count);
+    if (!media_loaded) {
+        fprintf(stderr, "NDL_DirectMediaLoad failed: %d\n", ret);
+        media_load_failed = true;
+        media_failure_reported = false;
+    }
     return ret;
-}
\ No newline at end of file
+}
+
+static void media_release() {
+    if (media_refs > 0 && --media_refs > 0) {
+        // The other stream is still running
+        return;
+    }
+    media_clock_print_stats(&media_clock);
+    media_unload();
+}
+
+static long media_ticks_ms() {
+    return (long) (media_ticks_us() / 1000);
+}
+
+static long long media_ticks_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Receive time a worker reported for the packet being submitted, or now if it came straight from ihslib.
+ */
+static long long media_arrival_us(long long *arrival) {
+    long long us = *arrival != 0 ? *arrival : media_ticks_us();
+    *arrival = 0;
+    return us;
+}
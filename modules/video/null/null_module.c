@@ -0,0 +1,217 @@
+// Accepts and drops every frame. Shows what the app and ihslib cost per frame without a decoder in the way
+
+#include "module.h"
+#include "annexb.h"
+#include "audio_packet.h"
+#include "sps_parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_NAL_UNITS 64
+
+typedef struct sink_stats_t {
+    uint64_t frames;
+    uint64_t bytes;
+    /* Time spent in submit, and between the end of one submit and the start of the next */
+    long long submit_ns, submit_max_ns;
+    long long gap_ns, gap_max_ns;
+    long long first, last;
+} sink_stats_t;
+
+static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context);
+
+static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context);
+
+static void audio_stop(IHS_Session *session, void *context);
+
+static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context);
+
+static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context);
+
+static void video_stop(IHS_Session *session, void *context);
+
+static void inspect_video(IHS_Buffer *data, IHS_StreamVideoFrameFlag flags);
+
+static void stats_begin(sink_stats_t *stats, long long now);
+
+static void stats_submitted(sink_stats_t *stats, size_t size, long long begin);
+
+static void stats_print(const char *name, const sink_stats_t *stats);
+
+static long long ticks_ns();
+
+/* Parse what real modules parse, so the numbers include it */
+static bool inspect = false;
+
+static IHS_StreamVideoCodec video_codec;
+static sink_stats_t video_stats;
+static uint64_t video_keyframes = 0, video_nal_units = 0;
+static bool video_sps_printed = false;
+
+static IHS_StreamAudioCodec audio_codec;
+static uint32_t audio_frequency = 0;
+static sink_stats_t audio_stats;
+static uint64_t audio_samples = 0;
+
+static const IHS_StreamAudioCallbacks audio_callbacks = {
+        .start = audio_start,
+        .submit = audio_submit,
+        .stop = audio_stop,
+};
+
+static const IHS_StreamVideoCallbacks video_callbacks = {
+        .start = video_start,
+        .submit = video_submit,
+        .stop = video_stop,
+};
+
+static void null_init(int argc, char *argv[]) {
+    inspect = getenv("IHSPLAY_NULL_INSPECT") != NULL;
+}
+
+static const IHS_StreamAudioCallbacks *null_audio_callbacks() {
+    return &audio_callbacks;
+}
+
+static const IHS_StreamVideoCallbacks *null_video_callbacks() {
+    return &video_callbacks;
+}
+
+IHSPLAY_MODULE_EXPORT const ihsplay_module_t ihsplay_module = {
+        .name = "null",
+        .init = null_init,
+        .audio = null_audio_callbacks,
+        .video = null_video_callbacks,
+};
+
+static int audio_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context) {
+    audio_codec = config->codec;
+    audio_frequency = config->frequency;
+    audio_samples = 0;
+    stats_begin(&audio_stats, ticks_ns());
+    return 0;
+}
+
+static int audio_submit(IHS_Session *session, IHS_Buffer *data, void *context) {
+    long long begin = ticks_ns();
+    if (inspect) {
+        const uint8_t *ptr = IHS_BufferPointer(data);
+        if (audio_codec == IHS_StreamAudioCodecOpus) {
+            audio_samples += opus_packet_samples(ptr, data->size, audio_frequency);
+        } else {
+            audio_samples += mp3_frame_samples(ptr, data->size);
+        }
+    }
+    stats_submitted(&audio_stats, data->size, begin);
+    return DR_OK;
+}
+
+static void audio_stop(IHS_Session *session, void *context) {
+    stats_print("Audio", &audio_stats);
+    if (inspect && audio_frequency > 0) {
+        printf("  %llu samples, %.2f s of audio\n", (unsigned long long) audio_samples,
+               (double) audio_samples / (double) audio_frequency);
+    }
+}
+
+static int video_start(IHS_Session *session, const IHS_StreamVideoConfig *config, void *context) {
+    video_codec = config->codec;
+    video_keyframes = 0;
+    video_nal_units = 0;
+    video_sps_printed = false;
+    stats_begin(&video_stats, ticks_ns());
+    printf("Null video sink, %u x %u%s\n", config->width, config->height, inspect ? ", inspecting frames" : "");
+    return 0;
+}
+
+static int video_submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags, void *context) {
+    long long begin = ticks_ns();
+    if (inspect) {
+        inspect_video(data, flags);
+    }
+    stats_submitted(&video_stats, data->size, begin);
+    return DR_OK;
+}
+
+static void video_stop(IHS_Session *session, void *context) {
+    stats_print("Video", &video_stats);
+    if (inspect && video_stats.frames > 0) {
+        printf("  %llu key frames, %.1f NAL units per frame\n", (unsigned long long) video_keyframes,
+               (double) video_nal_units / (double) video_stats.frames);
+    }
+}
+
+static void inspect_video(IHS_Buffer *data, IHS_StreamVideoFrameFlag flags) {
+    if (flags & IHS_StreamVideoFrameKeyFrame) {
+        video_keyframes++;
+    }
+    if (video_codec != IHS_StreamVideoCodecH264 && video_codec != IHS_StreamVideoCodecHEVC) {
+        return;
+    }
+    const uint8_t *ptr = IHS_BufferPointer(data);
+    nal_unit_t units[MAX_NAL_UNITS];
+    size_t count = annexb_scan(ptr, data->size, video_codec, units, MAX_NAL_UNITS);
+    video_nal_units += count;
+    bool hevc = video_codec == IHS_StreamVideoCodecHEVC;
+    for (size_t i = 0; i < count; i++) {
+        if (units[i].type != (hevc ? NAL_TYPE_HEVC_SPS : NAL_TYPE_H264_SPS)) {
+            continue;
+        }
+        sps_info_t info;
+        const uint8_t *sps = ptr + units[i].offset;
+        if ((hevc ? sps_parse_hevc(sps, units[i].size, &info) : sps_parse_h264(sps, units[i].size, &info)) &&
+            !video_sps_printed) {
+            printf("  SPS %u x %u, %u reorder frames\n", info.dimension.width, info.dimension.height,
+                   info.max_num_reorder_frames);
+            video_sps_printed = true;
+        }
+    }
+}
+
+static void stats_begin(sink_stats_t *stats, long long now) {
+    memset(stats, 0, sizeof(sink_stats_t));
+    stats->first = now;
+    stats->last = now;
+}
+
+static void stats_submitted(sink_stats_t *stats, size_t size, long long begin) {
+    long long end = ticks_ns();
+    long long elapsed = end - begin;
+    if (stats->frames > 0) {
+        long long gap = begin - stats->last;
+        stats->gap_ns += gap;
+        if (gap > stats->gap_max_ns) {
+            stats->gap_max_ns = gap;
+        }
+    }
+    stats->frames++;
+    stats->bytes += size;
+    stats->submit_ns += elapsed;
+    if (elapsed > stats->submit_max_ns) {
+        stats->submit_max_ns = elapsed;
+    }
+    stats->last = end;
+}
+
+static void stats_print(const char *name, const sink_stats_t *stats) {
+    if (stats->frames == 0) {
+        return;
+    }
+    double seconds = (double) (stats->last - stats->first) / 1e9;
+    printf("%s null sink: %llu frames, %.2f MB, %.1f frames/s, %.2f MB/s, submit avg %.3f us max %.3f us, "
+           "gap avg %.3f ms max %.3f ms\n", name, (unsigned long long) stats->frames, (double) stats->bytes / 1e6,
+           seconds > 0 ? (double) stats->frames / seconds : 0.0,
+           seconds > 0 ? (double) stats->bytes / 1e6 / seconds : 0.0,
+           (double) stats->submit_ns / 1000.0 / (double) stats->frames, (double) stats->submit_max_ns / 1000.0,
+           stats->frames > 1 ? (double) stats->gap_ns / 1e6 / (double) (stats->frames - 1) : 0.0,
+           (double) stats->gap_max_ns / 1e6);
+}
+
+static long long ticks_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
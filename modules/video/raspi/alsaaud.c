@@ -19,101 +19,366 @@
 
 #include "ihslib/audio.h"
 #include "decoders.h"
+#include "audio_gap.h"
+#include "audio_packet.h"
+#include "drift_ctl.h"
+#include "pcm_ring.h"
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 
 #include <opus_multistream.h>
 #include <alsa/asoundlib.h>
 
-#define CHECK_RETURN(f) if ((rc = f) < 0) { fprintf(stderr, "ALSA error code %d\n", rc); return ERROR_AUDIO_OPEN_FAILED; }
+#define CHECK_RETURN(f) if ((rc = f) < 0) { goto fail; }
 #define MAX_CHANNEL_COUNT 8
 #define FRAME_SIZE 240
 #define FRAME_BUFFER 12
+/* Longest duration a single Opus packet can have */
+#define OPUS_MAX_FRAME_MS 120
+/* Ring holds up to this much decoded audio ahead of ALSA */
+#define RING_MS 200
+/* Writer waits for the device with pcmLock held, so this bounds how long suspend, resume and stop wait for it */
+#define WRITER_WAIT_MS 10
+/* Low latency mode grows the period after this many underruns within the window */
+#define UNDERRUN_LIMIT 3
+#define UNDERRUN_WINDOW_MS 10000
 
 static snd_pcm_t *handle;
 static OpusMSDecoder *decoder;
 static short *pcmBuffer;
-static size_t pcmBufferSize;
-static int samplesPerFrame;
+/* Frames of the longest Opus packet */
+static int maxFrames;
+static int outputRate;
+static int outputChannels;
+static const char *outputDevice;
+/* Period of the open device, in frames */
+static snd_pcm_uframes_t outputPeriod;
 
-static int alsaaud_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context) {
-    int rc;
-    unsigned char alsaMapping[MAX_CHANNEL_COUNT];
-
-    /* The supplied mapping array has order: FL-FR-C-LFE-RL-RR-SL-SR
-     * ALSA expects the order: FL-FR-RL-RR-C-LFE-SL-SR
-     * We need copy the mapping locally and swap the channels around.
-     */
-//    alsaMapping[0] = opusConfig->mapping[0];
-//    alsaMapping[1] = opusConfig->mapping[1];
-//    if (opusConfig->channelCount >= 6) {
-//        alsaMapping[2] = opusConfig->mapping[4];
-//        alsaMapping[3] = opusConfig->mapping[5];
-//        alsaMapping[4] = opusConfig->mapping[2];
-//        alsaMapping[5] = opusConfig->mapping[3];
-//    }
-//    if (opusConfig->channelCount == 8) {
-//        alsaMapping[6] = opusConfig->mapping[6];
-//        alsaMapping[7] = opusConfig->mapping[7];
-//    }
-    alsaMapping[0] = 0;
-    alsaMapping[1] = 1;
-
-    samplesPerFrame = config->frequency;
-    pcmBufferSize = sizeof(short) * config->channels * samplesPerFrame * 64;
-    pcmBuffer = malloc(pcmBufferSize);
-    if (pcmBuffer == NULL)
-        return -1;
+/* Start from the smallest period the device takes, and grow it on underruns */
+static bool lowLatency = false;
+static long long underrunWindowStart;
+static int underrunsInWindow;
+/* Writer found the ring empty since the last write, an underrun now is the network's fault */
+static bool writerStarved;
 
-    decoder = opus_multistream_decoder_create(config->frequency, config->channels, 1,
-                                              1, alsaMapping, &rc);
+/* Guards the PCM handle against suspend and resume coming from the main thread */
+static pthread_mutex_t pcmLock = PTHREAD_MUTEX_INITIALIZER;
+/* Main thread waiting for pcmLock, the writer backs off so it can't keep taking the lock back */
+static atomic_int pcmWaiters = 0;
+static atomic_bool suspended = false;
+/* Set by resume, the submit thread owns the decoder */
+static atomic_bool decoderReset = false;
 
-    snd_pcm_hw_params_t *hw_params;
-    snd_pcm_sw_params_t *sw_params;
-    snd_pcm_uframes_t period_size = FRAME_SIZE * FRAME_BUFFER;
-    snd_pcm_uframes_t buffer_size = 2 * period_size;
-    unsigned int sampleRate = config->frequency;
+/* Decoded frames go from the submit thread to the writer thread */
+static pcm_ring_t ring;
+/* Posted for every decoded packet, so the writer can sleep while the ring is empty */
+static sem_t pcmAvailable;
+static pthread_t writer;
+static bool writerStarted = false;
+static atomic_bool writerRunning = false;
+/* Device delay in frames after the last write, published by the writer */
+static atomic_long deviceDelay = 0;
+/* Set by the writer when the device was reopened with a longer period */
+static atomic_bool latencyChanged = false;
+
+/* Submit thread only */
+static drift_ctl_t drift;
+static audio_gap_t gap;
+/* Receive time of the packet being submitted, 0 if submit runs on the receive thread */
+static long long packetArrival = 0;
+static int latencyTargetMs = 0;
+
+static struct {
+    /* Submit thread only */
+    uint64_t packets;
+    uint64_t overruns;
+    uint64_t droppedFrames;
+    uint64_t fillSum;
+    size_t fillMax;
+    uint64_t plcPackets;
+    uint64_t fecPackets;
+    /* Writer thread only */
+    uint64_t underruns;
+    uint64_t waits;
+    uint64_t periodGrowths;
+} stats;
+
+/* Opened ahead of the session by alsaaud_prewarm, with the config Steam almost always sends */
+static snd_pcm_t *prewarmed;
+static int prewarmedChannels;
+static int prewarmedRate;
+static snd_pcm_uframes_t prewarmedPeriod;
+
+void alsaaud_set_latency_target(int ms) {
+    latencyTargetMs = ms;
+}
+
+void alsaaud_set_low_latency(bool enabled) {
+    lowLatency = enabled;
+}
+
+/* Opus channel layouts (RFC 7845 section 5.1.1.2), with the mapping permuted into ALSA channel order. The decoder
+ * then writes frames ALSA can play as they are, there's no reordering pass */
+static const struct opus_layout {
+    int channels, streams, coupled;
+    unsigned char mapping[MAX_CHANNEL_COUNT];
+} opusLayouts[] = {
+        {1, 1, 0, {0}},
+        {2, 1, 1, {0, 1}},
+        /* FL FR RL RR C LFE, Opus order is FL C FR RL RR LFE */
+        {6, 4, 2, {0, 1, 2, 3, 4, 5}},
+        /* FL FR RL RR C LFE SL SR, Opus order is FL C FR SL SR RL RR LFE */
+        {8, 5, 3, {0, 1, 4, 5, 6, 7, 2, 3}},
+};
+
+static void *writer_run(void *arg);
+
+static void writer_stop();
+
+static void lock_from_main();
+
+static void conceal(const unsigned char *packet, int size, int packetFrames, long missing);
+
+static void queue_pcm(int frames);
+
+static void print_stats();
+
+static snd_pcm_uframes_t wanted_period(const char *device, int rate);
+
+static bool underrun_needs_growth();
+
+static void grow_period();
+
+static const char *tuning_path();
+
+static snd_pcm_uframes_t tuning_load(const char *device, int rate);
+
+static void tuning_save(const char *device, int rate, snd_pcm_uframes_t period);
+
+static long long ticks_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static long long ticks_ms() {
+    return ticks_us() / 1000;
+}
+
+/**
+ * Open a playback device and commit hardware and software parameters. Everything but decoding a packet is done here.
+ *
+ * @param period Frames per period, 0 for the smallest the device takes. Set to what the device picked.
+ */
+static int pcm_open(const char *device, unsigned int channels, unsigned int rate, snd_pcm_uframes_t *period,
+                    snd_pcm_t **pcm) {
+    int rc;
+    snd_pcm_t *h = NULL;
+    snd_pcm_hw_params_t *hw_params = NULL;
+    snd_pcm_sw_params_t *sw_params = NULL;
+    snd_pcm_uframes_t period_size = *period;
+    snd_pcm_uframes_t buffer_size;
+    unsigned int sampleRate = rate;
 
-    char *audio_device = (char *) context;
-    if (!audio_device) {
-        audio_device = "default";
-    }
     /* Open PCM device for playback. */
-    CHECK_RETURN(snd_pcm_open(&handle, audio_device, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK))
+    CHECK_RETURN(snd_pcm_open(&h, device, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK))
 
     /* Set hardware parameters */
     CHECK_RETURN(snd_pcm_hw_params_malloc(&hw_params));
-    CHECK_RETURN(snd_pcm_hw_params_any(handle, hw_params));
-    CHECK_RETURN(snd_pcm_hw_params_set_access(handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED));
-    CHECK_RETURN(snd_pcm_hw_params_set_format(handle, hw_params, SND_PCM_FORMAT_S16_LE));
-    CHECK_RETURN(snd_pcm_hw_params_set_rate_near(handle, hw_params, &sampleRate, NULL));
-    CHECK_RETURN(snd_pcm_hw_params_set_channels(handle, hw_params, config->channels));
-    CHECK_RETURN(snd_pcm_hw_params_set_period_size_near(handle, hw_params, &period_size, NULL));
-    CHECK_RETURN(snd_pcm_hw_params_set_buffer_size_near(handle, hw_params, &buffer_size));
-    CHECK_RETURN(snd_pcm_hw_params(handle, hw_params));
-    snd_pcm_hw_params_free(hw_params);
+    CHECK_RETURN(snd_pcm_hw_params_any(h, hw_params));
+    CHECK_RETURN(snd_pcm_hw_params_set_access(h, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED));
+    CHECK_RETURN(snd_pcm_hw_params_set_format(h, hw_params, SND_PCM_FORMAT_S16_LE));
+    CHECK_RETURN(snd_pcm_hw_params_set_rate_near(h, hw_params, &sampleRate, NULL));
+    CHECK_RETURN(snd_pcm_hw_params_set_channels(h, hw_params, channels));
+    if (period_size == 0) {
+        CHECK_RETURN(snd_pcm_hw_params_get_period_size_min(hw_params, &period_size, NULL));
+        /* Anything under 1 ms only adds wakeups */
+        if (period_size < rate / 1000) {
+            period_size = rate / 1000;
+        }
+    }
+    buffer_size = 2 * period_size;
+    CHECK_RETURN(snd_pcm_hw_params_set_period_size_near(h, hw_params, &period_size, NULL));
+    CHECK_RETURN(snd_pcm_hw_params_set_buffer_size_near(h, hw_params, &buffer_size));
+    CHECK_RETURN(snd_pcm_hw_params(h, hw_params));
 
     /* Set software parameters */
     CHECK_RETURN(snd_pcm_sw_params_malloc(&sw_params));
-    CHECK_RETURN(snd_pcm_sw_params_current(handle, sw_params));
-    CHECK_RETURN(snd_pcm_sw_params_set_avail_min(handle, sw_params, period_size));
-    CHECK_RETURN(snd_pcm_sw_params_set_start_threshold(handle, sw_params, 1));
-    CHECK_RETURN(snd_pcm_sw_params(handle, sw_params));
-    snd_pcm_sw_params_free(sw_params);
+    CHECK_RETURN(snd_pcm_sw_params_current(h, sw_params));
+    CHECK_RETURN(snd_pcm_sw_params_set_avail_min(h, sw_params, period_size));
+    CHECK_RETURN(snd_pcm_sw_params_set_start_threshold(h, sw_params, 1));
+    CHECK_RETURN(snd_pcm_sw_params(h, sw_params));
+
+    CHECK_RETURN(snd_pcm_prepare(h));
+
+    printf("ALSA %s: period %lu frames, buffer %lu frames\n", device, (unsigned long) period_size,
+           (unsigned long) buffer_size);
+    *period = period_size;
+    *pcm = h;
+    h = NULL;
+    fail:
+    if (sw_params != NULL) {
+        snd_pcm_sw_params_free(sw_params);
+    }
+    if (hw_params != NULL) {
+        snd_pcm_hw_params_free(hw_params);
+    }
+    if (h != NULL) {
+        snd_pcm_close(h);
+    }
+    return rc;
+}
+
+void alsaaud_prewarm() {
+    pthread_mutex_lock(&pcmLock);
+    if (handle == NULL && prewarmed == NULL) {
+        prewarmedChannels = 2;
+        prewarmedRate = 48000;
+        prewarmedPeriod = wanted_period("default", prewarmedRate);
+        if (pcm_open("default", prewarmedChannels, prewarmedRate, &prewarmedPeriod, &prewarmed) < 0) {
+            prewarmed = NULL;
+        }
+    }
+    pthread_mutex_unlock(&pcmLock);
+}
+
+void alsaaud_deinit() {
+    pthread_mutex_lock(&pcmLock);
+    if (prewarmed != NULL) {
+        snd_pcm_close(prewarmed);
+        prewarmed = NULL;
+    }
+    pthread_mutex_unlock(&pcmLock);
+}
+
+/* Release what a failed start has set up so far */
+static void start_unwind() {
+    pthread_mutex_lock(&pcmLock);
+    if (handle != NULL) {
+        snd_pcm_close(handle);
+        handle = NULL;
+    }
+    pthread_mutex_unlock(&pcmLock);
+    if (decoder != NULL) {
+        opus_multistream_decoder_destroy(decoder);
+        decoder = NULL;
+    }
+    free(pcmBuffer);
+    pcmBuffer = NULL;
+}
+
+static int alsaaud_start(IHS_Session *session, const IHS_StreamAudioConfig *config, void *context) {
+    int rc;
+    const struct opus_layout *layout = NULL;
+    for (size_t i = 0; i < sizeof(opusLayouts) / sizeof(opusLayouts[0]); i++) {
+        if (opusLayouts[i].channels == config->channels) {
+            layout = &opusLayouts[i];
+        }
+    }
+    if (layout == NULL) {
+        fprintf(stderr, "Unsupported audio channel count %d\n", (int) config->channels);
+        return ERROR_AUDIO_OPUS_INIT_FAILED;
+    }
+
+    outputRate = config->frequency;
+    maxFrames = config->frequency * OPUS_MAX_FRAME_MS / 1000;
+    /* One more frame for the drift controller to insert */
+    pcmBuffer = malloc(sizeof(short) * config->channels * (maxFrames + 1));
+    if (pcmBuffer == NULL)
+        return ERROR_OUT_OF_MEMORY;
+
+    decoder = opus_multistream_decoder_create(config->frequency, layout->channels, layout->streams,
+                                              layout->coupled, layout->mapping, &rc);
+    if (decoder == NULL) {
+        fprintf(stderr, "Opus error from decoder create: %d\n", rc);
+        free(pcmBuffer);
+        pcmBuffer = NULL;
+        return ERROR_AUDIO_OPUS_INIT_FAILED;
+    }
+
+    char *audio_device = (char *) context;
+    if (!audio_device) {
+        audio_device = "default";
+    }
+    outputDevice = audio_device;
+    outputChannels = (int) config->channels;
+    underrunWindowStart = ticks_ms();
+    underrunsInWindow = 0;
+    writerStarved = false;
+    long long begin = ticks_ms();
+    pthread_mutex_lock(&pcmLock);
+    bool reused = prewarmed != NULL && strcmp(audio_device, "default") == 0 &&
+                  prewarmedChannels == config->channels && prewarmedRate == config->frequency;
+    if (reused) {
+        /* Only the stream state is left to reset, hardware parameters are committed already */
+        handle = prewarmed;
+        outputPeriod = prewarmedPeriod;
+        prewarmed = NULL;
+        rc = snd_pcm_prepare(handle);
+    } else {
+        if (prewarmed != NULL) {
+            snd_pcm_close(prewarmed);
+            prewarmed = NULL;
+        }
+        outputPeriod = wanted_period(audio_device, (int) config->frequency);
+        rc = pcm_open(audio_device, config->channels, config->frequency, &outputPeriod, &handle);
+    }
+    pthread_mutex_unlock(&pcmLock);
+    if (rc < 0) {
+        fprintf(stderr, "ALSA error code %d\n", rc);
+        start_unwind();
+        return ERROR_AUDIO_OPEN_FAILED;
+    }
+    printf("ALSA output ready in %lld ms%s\n", ticks_ms() - begin, reused ? " (pre-warmed)" : "");
 
-    CHECK_RETURN(snd_pcm_prepare(handle));
+    memset(&stats, 0, sizeof(stats));
+    drift_ctl_init(&drift, config->frequency, latencyTargetMs);
+    audio_gap_init(&gap, config->frequency);
+    atomic_store(&deviceDelay, 0);
+    if (!pcm_ring_init(&ring, config->frequency * RING_MS / 1000, config->channels)) {
+        start_unwind();
+        return ERROR_OUT_OF_MEMORY;
+    }
+    sem_init(&pcmAvailable, 0, 0);
+    atomic_store(&writerRunning, true);
+    if (pthread_create(&writer, NULL, writer_run, NULL) != 0) {
+        atomic_store(&writerRunning, false);
+        sem_destroy(&pcmAvailable);
+        pcm_ring_deinit(&ring);
+        start_unwind();
+        return ERROR_AUDIO_OPEN_FAILED;
+    }
+    writerStarted = true;
 
     return 0;
 }
 
 static void alsaaud_stop() {
-    if (decoder != NULL)
+    writer_stop();
+
+    if (decoder != NULL) {
         opus_multistream_decoder_destroy(decoder);
+        decoder = NULL;
+    }
 
+    pthread_mutex_lock(&pcmLock);
     if (handle != NULL) {
-        snd_pcm_drain(handle);
+        if (!suspended) {
+            snd_pcm_drain(handle);
+        }
         snd_pcm_close(handle);
+        handle = NULL;
     }
+    suspended = false;
+    pthread_mutex_unlock(&pcmLock);
 
     if (pcmBuffer != NULL) {
         free(pcmBuffer);
@@ -121,29 +386,320 @@ static void alsaaud_stop() {
     }
 }
 
+void alsaaud_suspend() {
+    lock_from_main();
+    if (handle != NULL && !suspended) {
+        snd_pcm_drop(handle);
+        suspended = true;
+    }
+    pthread_mutex_unlock(&pcmLock);
+}
+
+void alsaaud_resume() {
+    lock_from_main();
+    if (handle != NULL && suspended) {
+        snd_pcm_prepare(handle);
+        atomic_store(&decoderReset, true);
+        suspended = false;
+    }
+    pthread_mutex_unlock(&pcmLock);
+}
+
+void alsaaud_set_arrival(long long us) {
+    packetArrival = us;
+}
+
+/**
+ * Take pcmLock against a writer that holds it most of the time while the device buffer is full.
+ */
+static void lock_from_main() {
+    atomic_fetch_add(&pcmWaiters, 1);
+    pthread_mutex_lock(&pcmLock);
+    atomic_fetch_sub(&pcmWaiters, 1);
+}
+
 static int alsaaud_submit(IHS_Session *session, IHS_Buffer *data, void *context) {
     (void) context;
-    int decodeLen = opus_multistream_decode(decoder, IHS_BufferPointer(data), (int) data->size,
-                                            pcmBuffer, (int) pcmBufferSize, 0);
-    if (decodeLen > 0) {
-        int rc;
-        if ((rc = snd_pcm_writei(handle, pcmBuffer, decodeLen)) == -EPIPE) {
-            snd_pcm_prepare(handle);
-        } else if (rc < 0) {
-            fprintf(stderr, "ALSA error from writei: %d\n", rc);
-        }
-    } else {
+    /* Submitted straight from the receive thread if nobody said otherwise. Taken before any early return, so it
+     * doesn't stick to the next packet */
+    long long arrival = packetArrival != 0 ? packetArrival : ticks_us();
+    packetArrival = 0;
+    if (suspended) {
+        return 0;
+    }
+    if (atomic_exchange(&decoderReset, false)) {
+        opus_multistream_decoder_ctl(decoder, OPUS_RESET_STATE);
+        drift_ctl_reset(&drift);
+        audio_gap_reset(&gap);
+    } else if (atomic_exchange(&latencyChanged, false)) {
+        drift_ctl_reset(&drift);
+    }
+    const unsigned char *packet = IHS_BufferPointer(data);
+    int packetFrames = (int) opus_packet_samples(packet, data->size, outputRate);
+    long missing = audio_gap_update(&gap, arrival, packetFrames);
+    if (missing > 0) {
+        conceal(packet, (int) data->size, packetFrames, missing);
+    }
+    int decodeLen = opus_multistream_decode(decoder, packet, (int) data->size, pcmBuffer, maxFrames, 0);
+    if (decodeLen <= 0) {
         fprintf(stderr, "Opus error from decode: %d\n", decodeLen);
+        return 0;
     }
+    queue_pcm(decodeLen);
+    sem_post(&pcmAvailable);
     return 0;
 }
 
+/**
+ * Synthesise frames of lost packets, so playback continues at the right length instead of skipping.
+ */
+static void conceal(const unsigned char *packet, int size, int packetFrames, long missing) {
+    for (long left = missing; left > 0; left -= packetFrames) {
+        /* In-band FEC of a packet only covers the one right before it, anything earlier is extrapolated */
+        bool fec = left == packetFrames;
+        int decodeLen = opus_multistream_decode(decoder, fec ? packet : NULL, fec ? size : 0, pcmBuffer,
+                                                packetFrames, fec ? 1 : 0);
+        if (decodeLen <= 0) {
+            fprintf(stderr, "Opus error from concealment: %d\n", decodeLen);
+            return;
+        }
+        if (fec) {
+            stats.fecPackets++;
+        } else {
+            stats.plcPackets++;
+        }
+        queue_pcm(decodeLen);
+    }
+}
+
+static void queue_pcm(int frames) {
+    size_t fill = pcm_ring_fill(&ring);
+    stats.packets++;
+    stats.fillSum += fill;
+    if (fill > stats.fillMax) {
+        stats.fillMax = fill;
+    }
+    /* Ring fill plus device delay is everything between this packet and the speaker */
+    int correction = drift_ctl_update(&drift, atomic_load(&deviceDelay) + (long) fill, (size_t) frames);
+    frames = (int) drift_ctl_apply(pcmBuffer, (size_t) frames, ring.channels, correction);
+    size_t written = pcm_ring_write(&ring, pcmBuffer, (size_t) frames);
+    if (written < (size_t) frames) {
+        /* Writer is behind by a full ring, newest audio has to go */
+        stats.overruns++;
+        stats.droppedFrames += (size_t) frames - written;
+    }
+}
+
+static void *writer_run(void *arg) {
+    (void) arg;
+    while (atomic_load(&writerRunning)) {
+        const int16_t *pcm;
+        size_t frames = pcm_ring_peek(&ring, &pcm);
+        if (frames == 0) {
+            writerStarved = true;
+            while (sem_wait(&pcmAvailable) != 0 && errno == EINTR) {
+            }
+            continue;
+        }
+        pthread_mutex_lock(&pcmLock);
+        if (suspended || handle == NULL) {
+            /* Stale by the time playback resumes, or there's no device to play it after a failed reopen */
+            pthread_mutex_unlock(&pcmLock);
+            pcm_ring_consume(&ring, frames);
+            continue;
+        }
+        snd_pcm_sframes_t rc = snd_pcm_writei(handle, pcm, frames);
+        snd_pcm_sframes_t delay;
+        if (rc > 0 && snd_pcm_delay(handle, &delay) == 0) {
+            atomic_store(&deviceDelay, delay);
+        }
+        if (rc == -EPIPE) {
+            stats.underruns++;
+            if (lowLatency && !writerStarved && underrun_needs_growth()) {
+                grow_period();
+                rc = 0;
+            } else {
+                rc = snd_pcm_prepare(handle);
+            }
+        } else if (rc == -EAGAIN) {
+            /* Device buffer is full, sleep until a period has played. The handle is only safe to use under the lock */
+            stats.waits++;
+            snd_pcm_wait(handle, WRITER_WAIT_MS);
+        } else if (rc < 0) {
+            fprintf(stderr, "ALSA error from writei: %ld\n", (long) rc);
+            if (snd_pcm_recover(handle, (int) rc, 1) < 0) {
+                /* Drop what can't be played, instead of spinning on it */
+                rc = (snd_pcm_sframes_t) frames;
+            }
+        }
+        pthread_mutex_unlock(&pcmLock);
+        while (atomic_load(&pcmWaiters) > 0) {
+            sched_yield();
+        }
+        if (rc > 0) {
+            pcm_ring_consume(&ring, (size_t) rc);
+            writerStarved = false;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Writer thread only. Underruns the ring had data for are the period's fault.
+ */
+static bool underrun_needs_growth() {
+    long long now = ticks_ms();
+    if (now - underrunWindowStart > UNDERRUN_WINDOW_MS) {
+        underrunWindowStart = now;
+        underrunsInWindow = 0;
+    }
+    return ++underrunsInWindow >= UNDERRUN_LIMIT;
+}
+
+/**
+ * Writer thread only, with pcmLock held. Reopen the device with twice the period, and remember it for the device.
+ */
+static void grow_period() {
+    snd_pcm_uframes_t period = outputPeriod * 2;
+    if (period > FRAME_SIZE * FRAME_BUFFER) {
+        /* Already as long as outside of low latency mode */
+        snd_pcm_prepare(handle);
+        return;
+    }
+    printf("ALSA %s: %d underruns in %d s at %lu frame period, growing it to %lu frames\n", outputDevice,
+           underrunsInWindow, UNDERRUN_WINDOW_MS / 1000, (unsigned long) outputPeriod, (unsigned long) period);
+    snd_pcm_close(handle);
+    handle = NULL;
+    if (pcm_open(outputDevice, outputChannels, outputRate, &period, &handle) < 0) {
+        fprintf(stderr, "ALSA %s: reopen failed, audio stays off until the next session\n", outputDevice);
+        handle = NULL;
+        return;
+    }
+    outputPeriod = period;
+    stats.periodGrowths++;
+    underrunWindowStart = ticks_ms();
+    underrunsInWindow = 0;
+    atomic_store(&deviceDelay, 0);
+    atomic_store(&latencyChanged, true);
+    tuning_save(outputDevice, outputRate, outputPeriod);
+}
+
+static snd_pcm_uframes_t wanted_period(const char *device, int rate) {
+    if (!lowLatency) {
+        return FRAME_SIZE * FRAME_BUFFER;
+    }
+    return tuning_load(device, rate);
+}
+
+/**
+ * Tuned periods, one "device rate period" line per device and rate.
+ */
+static const char *tuning_path() {
+    static char path[PATH_MAX];
+    const char *override = getenv("IHSPLAY_ALSA_TUNING_FILE");
+    if (override != NULL) {
+        return override;
+    }
+    const char *home = getenv("HOME");
+    if (home == NULL) {
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/.ihsplay-alsa-tuning", home);
+    return path;
+}
+
+/**
+ * @return Tuned period for the device, or 0 to start from the smallest one
+ */
+static snd_pcm_uframes_t tuning_load(const char *device, int rate) {
+    const char *path = tuning_path();
+    FILE *file = path != NULL ? fopen(path, "r") : NULL;
+    if (file == NULL) {
+        return 0;
+    }
+    char name[256];
+    int lineRate;
+    unsigned long period;
+    snd_pcm_uframes_t result = 0;
+    while (fscanf(file, "%255s %d %lu", name, &lineRate, &period) == 3) {
+        if (strcmp(name, device) == 0 && lineRate == rate) {
+            result = period;
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+static void tuning_save(const char *device, int rate, snd_pcm_uframes_t period) {
+    const char *path = tuning_path();
+    if (path == NULL) {
+        return;
+    }
+    char tmpPath[PATH_MAX];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *out = fopen(tmpPath, "w");
+    if (out == NULL) {
+        return;
+    }
+    FILE *in = fopen(path, "r");
+    if (in != NULL) {
+        char name[256];
+        int lineRate;
+        unsigned long linePeriod;
+        while (fscanf(in, "%255s %d %lu", name, &lineRate, &linePeriod) == 3) {
+            if (strcmp(name, device) != 0 || lineRate != rate) {
+                fprintf(out, "%s %d %lu\n", name, lineRate, linePeriod);
+            }
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s %d %lu\n", device, rate, (unsigned long) period);
+    if (fclose(out) != 0 || rename(tmpPath, path) != 0) {
+        remove(tmpPath);
+    }
+}
+
+static void writer_stop() {
+    if (!writerStarted) {
+        return;
+    }
+    atomic_store(&writerRunning, false);
+    sem_post(&pcmAvailable);
+    pthread_join(writer, NULL);
+    writerStarted = false;
+    print_stats();
+    sem_destroy(&pcmAvailable);
+    pcm_ring_deinit(&ring);
+}
+
+static void print_stats() {
+    if (stats.packets == 0) {
+        return;
+    }
+    double msPerFrame = 1000.0 / outputRate;
+    printf("ALSA writer: %llu packets, ring fill avg %.1f ms max %.1f ms of %.1f ms, %llu overruns (%llu frames "
+           "dropped), %llu underruns, %llu waits for device\n", (unsigned long long) stats.packets,
+           (double) stats.fillSum / (double) stats.packets * msPerFrame, (double) stats.fillMax * msPerFrame,
+           (double) pcm_ring_capacity(&ring) * msPerFrame, (unsigned long long) stats.overruns,
+           (unsigned long long) stats.droppedFrames, (unsigned long long) stats.underruns,
+           (unsigned long long) stats.waits);
+    if (lowLatency) {
+        printf("ALSA low latency: period settled at %lu frames (%.1f ms) after %llu growths\n",
+               (unsigned long) outputPeriod, (double) outputPeriod * msPerFrame,
+               (unsigned long long) stats.periodGrowths);
+    }
+    printf("ALSA concealment: %llu packets recovered from FEC, %llu synthesised by PLC\n",
+           (unsigned long long) stats.fecPackets, (unsigned long long) stats.plcPackets);
+    audio_gap_print_stats(&gap);
+    drift_ctl_print_stats(&drift);
+}
+
 const IHS_StreamAudioCallbacks AudioCallbacks = {
         .start = alsaaud_start,
         .stop = alsaaud_stop,
         .submit = alsaaud_submit,
 };
 
-const IHS_StreamAudioCallbacks *module_audio_callbacks() {
+const IHS_StreamAudioCallbacks *alsaaud_callbacks() {
     return &AudioCallbacks;
 }
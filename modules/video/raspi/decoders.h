@@ -24,6 +24,11 @@
  */
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "module.h"
+
 #define ERROR_OUT_OF_MEMORY -2
 #define ERROR_UNKNOWN_CODEC 0x1010
 #define ERROR_DECODER_OPEN_FAILED 0x1011
@@ -32,5 +37,55 @@
 #define ERROR_AUDIO_CLOSE_FAILED 0x1022
 #define ERROR_AUDIO_OPUS_INIT_FAILED 0x1023
 
-#define DR_OK 0
-#define DR_NEED_IDR 1
\ No newline at end of file
+const IHS_StreamVideoCallbacks *mmalvid_callbacks();
+
+/**
+ * Number of compressed frames that can be queued to the decoder before Submit has to wait.
+ */
+void mmalvid_set_input_depth(uint32_t depth);
+
+/**
+ * Bring up VideoCore and create decoder and renderer components ahead of the session. Safe to call from any thread.
+ */
+void mmalvid_prewarm();
+
+/**
+ * Destroy pre-warmed components no session took.
+ */
+void mmalvid_deinit();
+
+void mmalvid_suspend();
+
+void mmalvid_resume();
+
+const IHS_StreamAudioCallbacks *alsaaud_callbacks();
+
+/**
+ * @param ms Output latency to hold against clock drift, or 0 to hold whatever the stream settles at
+ */
+void alsaaud_set_latency_target(int ms);
+
+/**
+ * Start from the smallest period the device takes and double it whenever underruns keep coming, instead of a fixed
+ * 60 ms period. The tuned period is remembered per device, in IHSPLAY_ALSA_TUNING_FILE or ~/.ihsplay-alsa-tuning.
+ */
+void alsaaud_set_low_latency(bool enabled);
+
+/**
+ * Open the default device for 48 kHz stereo, the first session adopts it if its config matches.
+ */
+void alsaaud_prewarm();
+
+/**
+ * Close the pre-warmed device if no session took it.
+ */
+void alsaaud_deinit();
+
+/**
+ * Receive time of the packet the next submit gets, so loss detection isn't thrown off by queueing.
+ */
+void alsaaud_set_arrival(long long us);
+
+void alsaaud_suspend();
+
+void alsaaud_resume();
@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include <bcm_host.h>
 #include <interface/mmal/mmal.h>
@@ -42,31 +43,106 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <SDL.h>
 
+#include "annexb.h"
+#include "backpressure.h"
 #include "decoders.h"
+#include "param_cache.h"
 #include "sps_parser.h"
 
 #define MAX_DECODE_UNIT_SIZE 262144
+/* Longest time the network thread waits for the decoder to give back an input buffer */
+#define INPUT_WAIT_MS 20
+/* Waits longer than this count as a stall */
+#define STALL_THRESHOLD_US 1000
 
 #define ALIGN(x, a) (((x)+(a)-1)&~((a)-1))
 
+#define MAX_SPS_SIZE 1024
+
 
 static bool started = false;
-static VCOS_SEMAPHORE_T semaphore;
+static uint32_t input_depth = 5;
+/* Cleared before the output port goes away, so renderer releases stop feeding it */
+static volatile bool recycle_output = false;
 static MMAL_COMPONENT_T *decoder = NULL, *renderer = NULL;
 static MMAL_POOL_T *pool_in = NULL, *pool_out = NULL;
 
-
-static bool SizeChanged(const MMAL_VIDEO_FORMAT_T *video, const sps_dimension_t *dimension);
+/* Guards the pipeline against module_suspend()/module_resume() coming from the main thread */
+static pthread_mutex_t pipeline_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool suspended = false, need_keyframe = false, keyframe_requested = false;
+static uint32_t stream_width = 0, stream_height = 0;
+/* Last SPS seen, frame rate and colour space go to port formats */
+static sps_info_t stream_info;
+static bool stream_info_valid = false, sps_rewritten = false;
+/* Parameter sets go in front of the first frame a fresh decoder gets, unless that frame has its own */
+static param_cache_t param_cache;
+static bool inject_params = false;
+static Uint32 resume_ticks = 0;
+
+/* Format reported by MMAL_EVENT_FORMAT_CHANGED on the output port, applied on the next Submit */
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool format_changed = false;
+static MMAL_ES_FORMAT_T *changed_format = NULL;
+/* Submit's copy of it, port disable can run the callback so the lock can't be held */
+static MMAL_ES_FORMAT_T *applied_format = NULL;
+static uint32_t changed_buffer_num = 0, changed_buffer_size = 0;
+
+static backpressure_t backpressure;
+
+/* VideoCore bring up is slow and only ever needed once */
+static pthread_once_t vc_once = PTHREAD_ONCE_INIT;
+/* Components created by mmalvid_prewarm, adopted by the next setup_decoder */
+static pthread_mutex_t spare_lock = PTHREAD_MUTEX_INITIALIZER;
+static MMAL_COMPONENT_T *spare_decoder = NULL, *spare_renderer = NULL;
+
+static struct {
+    uint64_t frames;
+    uint64_t stalls;
+    uint64_t timeouts;
+    uint64_t wait_us;
+    uint64_t max_wait_us;
+    Uint64 begin;
+} stats;
+
+
+static bool FormatChanged(const MMAL_VIDEO_FORMAT_T *video, const sps_info_t *info);
+
+static MMAL_FOURCC_T stream_color_space(const sps_info_t *info);
 
 static void ChangedSize(IHS_Session *session, const sps_dimension_t *dimension);
 
+static bool apply_output_format(const MMAL_ES_FORMAT_T *format, uint32_t buffer_num, uint32_t buffer_size);
+
 static int setup_decoder(uint32_t width, uint32_t height);
 
+static void set_decoder_format(MMAL_ES_FORMAT_T *format, uint32_t width, uint32_t height);
+
+static void set_renderer_format(MMAL_ES_FORMAT_T *format, uint32_t width, uint32_t height);
+
+static bool reconfigure_decoder(uint32_t width, uint32_t height);
+
+static void fill_output();
+
+static void teardown_decoder();
+
+static void vc_init();
+
+static MMAL_STATUS_T component_create(const char *name, MMAL_COMPONENT_T **spare, MMAL_COMPONENT_T **component);
+
+static void print_stats();
+
 static void input_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf) {
+    // Goes back to the pool queue, where Submit picks it up
     mmal_buffer_header_release(buf);
+}
 
-    if (port == decoder->input[0])
-        vcos_semaphore_post(&semaphore);
+static MMAL_BOOL_T output_pool_callback(MMAL_POOL_T *pool, MMAL_BUFFER_HEADER_T *buf, void *userdata) {
+    MMAL_PORT_T *port = userdata;
+    // Renderer is done with this picture, give it straight back to the decoder
+    if (recycle_output && mmal_port_send_buffer(port, buf) == MMAL_SUCCESS) {
+        return MMAL_FALSE;
+    }
+    return MMAL_TRUE;
 }
 
 static void control_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf) {
@@ -79,6 +155,23 @@ static void control_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf) {
 }
 
 static void output_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf) {
+    if (buf->cmd == MMAL_EVENT_FORMAT_CHANGED) {
+        // Decoder found a new format in the stream by itself. Ports can't be touched from this thread
+        MMAL_EVENT_FORMAT_CHANGED_T *event = mmal_event_format_changed_get(buf);
+        if (event != NULL) {
+            pthread_mutex_lock(&event_lock);
+            if (mmal_format_full_copy(changed_format, event->format) == MMAL_SUCCESS) {
+                changed_buffer_num = event->buffer_num_recommended;
+                changed_buffer_size = event->buffer_size_recommended;
+                format_changed = true;
+            } else {
+                fprintf(stderr, "Can't copy changed output format\n");
+            }
+            pthread_mutex_unlock(&event_lock);
+        }
+        mmal_buffer_header_release(buf);
+        return;
+    }
     if (mmal_port_send_buffer(renderer->input[0], buf) != MMAL_SUCCESS) {
         fprintf(stderr, "Can't display decoded frame\n");
         mmal_buffer_header_release(buf);
@@ -93,45 +186,62 @@ static int Start(IHS_Session *session, const IHS_StreamVideoConfig *config, void
         return ERROR_UNKNOWN_CODEC;
     }
 
-    bcm_host_init();
-    mmal_vc_init();
+    Uint32 start_ticks = SDL_GetTicks();
+    pthread_once(&vc_once, vc_init);
+
+    memset(&stats, 0, sizeof(stats));
+    stats.begin = SDL_GetPerformanceCounter();
+    backpressure_init(&backpressure, config->codec);
+    param_cache_init(&param_cache, config->codec);
+    memset(&stream_info, 0, sizeof(stream_info));
+    stream_info_valid = false;
+    sps_rewritten = false;
+    // A session stopped while suspended leaves these behind
+    need_keyframe = false;
+    keyframe_requested = false;
 
     uint32_t width = config->width;
     uint32_t height = config->height;
 
-    return setup_decoder(width, height);
+    int ret = setup_decoder(width, height);
+    printf("mmal decoder ready in %u ms\n", SDL_GetTicks() - start_ticks);
+    return ret;
 
 }
 
 static int setup_decoder(uint32_t width, uint32_t height) {
-    vcos_semaphore_create(&semaphore, "video_decoder", 1);
-    if (mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_DECODER, &decoder) != MMAL_SUCCESS) {
+    stream_width = width;
+    stream_height = height;
+    if (component_create(MMAL_COMPONENT_DEFAULT_VIDEO_DECODER, &spare_decoder, &decoder) != MMAL_SUCCESS) {
         fprintf(stderr, "Can't create decoder\n");
         return ERROR_DECODER_OPEN_FAILED;
     }
     printf("create decoder %d x %d\n", width, height);
 
-    MMAL_ES_FORMAT_T *format_in = decoder->input[0]->format;
-    format_in->type = MMAL_ES_TYPE_VIDEO;
-    format_in->encoding = MMAL_ENCODING_H264;
-    format_in->es->video.width = ALIGN(width, 32);
-    format_in->es->video.height = ALIGN(height, 16);
-    format_in->es->video.crop.width = width;
-    format_in->es->video.crop.height = height;
-    format_in->es->video.frame_rate.num = 0;
-    format_in->es->video.frame_rate.den = 1;
-    format_in->es->video.par.num = 1;
-    format_in->es->video.par.den = 1;
-    format_in->flags = MMAL_ES_FORMAT_FLAG_FRAMED;
-
+    set_decoder_format(decoder->input[0]->format, width, height);
     if (mmal_port_format_commit(decoder->input[0]) != MMAL_SUCCESS) {
         fprintf(stderr, "Can't commit input format to decoder\n");
         return ERROR_DECODER_OPEN_FAILED;
     }
 
-    decoder->input[0]->buffer_num = 5;
+    // Every input buffer can be in flight at once
+    decoder->input[0]->buffer_num = input_depth;
+    if (decoder->input[0]->buffer_num < decoder->input[0]->buffer_num_min) {
+        decoder->input[0]->buffer_num = decoder->input[0]->buffer_num_min;
+    }
     decoder->input[0]->buffer_size = MAX_DECODE_UNIT_SIZE;
-    pool_in = mmal_port_pool_create(decoder->input[0], decoder->input[0]->buffer_num, decoder->output[0]->buffer_size);
+    if (decoder->input[0]->buffer_size < decoder->input[0]->buffer_size_min) {
+        decoder->input[0]->buffer_size = decoder->input[0]->buffer_size_min;
+    }
+    // Payloads are allocated in memory shared with VideoCore, so frames are copied once instead of twice
+    if (mmal_port_parameter_set_boolean(decoder->input[0], MMAL_PARAMETER_ZERO_COPY, MMAL_TRUE) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't enable zero copy on decoder input\n");
+    }
+    pool_in = mmal_port_pool_create(decoder->input[0], decoder->input[0]->buffer_num, decoder->input[0]->buffer_size);
+    if (pool_in == NULL) {
+        fprintf(stderr, "Can't create decoder input pool\n");
+        return ERROR_DECODER_OPEN_FAILED;
+    }
 
     MMAL_ES_FORMAT_T *format_out = decoder->output[0]->format;
     format_out->encoding = MMAL_ENCODING_OPAQUE;
@@ -144,25 +254,23 @@ static int setup_decoder(uint32_t width, uint32_t height) {
     decoder->output[0]->buffer_size = decoder->output[0]->buffer_size_recommended;
     pool_out = mmal_port_pool_create(decoder->output[0], decoder->output[0]->buffer_num,
                                      decoder->output[0]->buffer_size);
+    if (pool_out == NULL) {
+        fprintf(stderr, "Can't create decoder output pool\n");
+        return ERROR_DECODER_OPEN_FAILED;
+    }
+    mmal_pool_callback_set(pool_out, output_pool_callback, decoder->output[0]);
 
     if (mmal_port_enable(decoder->control, control_callback) != MMAL_SUCCESS) {
         fprintf(stderr, "Can't enable control port\n");
         return ERROR_DECODER_OPEN_FAILED;
     }
 
-    if (mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, &renderer) != MMAL_SUCCESS) {
+    if (component_create(MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, &spare_renderer, &renderer) != MMAL_SUCCESS) {
         fprintf(stderr, "Can't create renderer\n");
         return ERROR_DECODER_OPEN_FAILED;
     }
 
-    format_in = renderer->input[0]->format;
-    format_in->encoding = MMAL_ENCODING_OPAQUE;
-    format_in->es->video.width = width;
-    format_in->es->video.height = height;
-    format_in->es->video.crop.x = 0;
-    format_in->es->video.crop.y = 0;
-    format_in->es->video.crop.width = width;
-    format_in->es->video.crop.height = height;
+    set_renderer_format(renderer->input[0]->format, width, height);
     if (mmal_port_format_commit(renderer->input[0]) != MMAL_SUCCESS) {
         fprintf(stderr, "Can't set output format\n");
         return ERROR_DECODER_OPEN_FAILED;
@@ -233,52 +341,383 @@ static int setup_decoder(uint32_t width, uint32_t height) {
         return ERROR_DECODER_OPEN_FAILED;
     }
 
-    printf("mmal decoder initialized\n");
+    fill_output();
+
+    printf("mmal decoder initialized, %u input buffers in flight\n", decoder->input[0]->buffer_num);
     started = true;
+    inject_params = true;
     return 0;
 }
 
-static void Stop(IHS_Session *session, void *context) {
-    started = false;
-    if (decoder)
+static void set_decoder_format(MMAL_ES_FORMAT_T *format, uint32_t width, uint32_t height) {
+    format->type = MMAL_ES_TYPE_VIDEO;
+    format->encoding = MMAL_ENCODING_H264;
+    format->es->video.width = ALIGN(width, 32);
+    format->es->video.height = ALIGN(height, 16);
+    format->es->video.crop.width = width;
+    format->es->video.crop.height = height;
+    if (stream_info.frame_rate_num != 0) {
+        format->es->video.frame_rate.num = (int32_t) stream_info.frame_rate_num;
+        format->es->video.frame_rate.den = (int32_t) stream_info.frame_rate_den;
+    } else {
+        format->es->video.frame_rate.num = 0;
+        format->es->video.frame_rate.den = 1;
+    }
+    format->es->video.par.num = 1;
+    format->es->video.par.den = 1;
+    format->es->video.color_space = stream_color_space(&stream_info);
+    format->flags = MMAL_ES_FORMAT_FLAG_FRAMED;
+}
+
+static void set_renderer_format(MMAL_ES_FORMAT_T *format, uint32_t width, uint32_t height) {
+    format->encoding = MMAL_ENCODING_OPAQUE;
+    format->es->video.width = width;
+    format->es->video.height = height;
+    format->es->video.crop.x = 0;
+    format->es->video.crop.y = 0;
+    format->es->video.crop.width = width;
+    format->es->video.crop.height = height;
+    format->es->video.color_space = stream_color_space(&stream_info);
+}
+
+/**
+ * Apply a new stream size to the running pipeline. Components, the dispmanx layer and input pool stay alive,
+ * only the ports are disabled for the format commit.
+ */
+static bool reconfigure_decoder(uint32_t width, uint32_t height) {
+    Uint32 begin = SDL_GetTicks();
+    // Pictures released by the renderer from now on stay in the pool
+    recycle_output = false;
+    if (mmal_port_disable(decoder->input[0]) != MMAL_SUCCESS ||
+        mmal_port_disable(decoder->output[0]) != MMAL_SUCCESS ||
+        mmal_port_disable(renderer->input[0]) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't disable ports for reconfiguration\n");
+        return false;
+    }
+
+    set_decoder_format(decoder->input[0]->format, width, height);
+    if (mmal_port_format_commit(decoder->input[0]) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't commit input format to decoder\n");
+        return false;
+    }
+    decoder->output[0]->format->encoding = MMAL_ENCODING_OPAQUE;
+    if (mmal_port_format_commit(decoder->output[0]) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't commit output format to decoder\n");
+        return false;
+    }
+    decoder->output[0]->buffer_num = pool_out->headers_num;
+    decoder->output[0]->buffer_size = decoder->output[0]->buffer_size_recommended;
+    if (decoder->output[0]->buffer_size > pool_out->header[0]->alloc_size &&
+        mmal_pool_resize(pool_out, pool_out->headers_num, decoder->output[0]->buffer_size) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't resize decoder output pool\n");
+        return false;
+    }
+    set_renderer_format(renderer->input[0]->format, width, height);
+    if (mmal_port_format_commit(renderer->input[0]) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't set output format\n");
+        return false;
+    }
+
+    if (mmal_port_enable(renderer->input[0], input_callback) != MMAL_SUCCESS ||
+        mmal_port_enable(decoder->input[0], input_callback) != MMAL_SUCCESS ||
+        mmal_port_enable(decoder->output[0], output_callback) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't enable ports after reconfiguration\n");
+        return false;
+    }
+    fill_output();
+    stream_width = width;
+    stream_height = height;
+    inject_params = true;
+    printf("mmal decoder reconfigured to %d x %d in %u ms\n", width, height, SDL_GetTicks() - begin);
+    return true;
+}
+
+/**
+ * Take the format the decoder announced with MMAL_EVENT_FORMAT_CHANGED. Only the decoder output and renderer input
+ * are cycled, the renderer gives back its pictures so the output pool can grow.
+ */
+static bool apply_output_format(const MMAL_ES_FORMAT_T *format, uint32_t buffer_num, uint32_t buffer_size) {
+    Uint32 begin = SDL_GetTicks();
+    recycle_output = false;
+    if (mmal_port_disable(decoder->output[0]) != MMAL_SUCCESS ||
+        mmal_port_disable(renderer->input[0]) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't disable ports for format change\n");
+        return false;
+    }
+    if (mmal_format_full_copy(decoder->output[0]->format, format) != MMAL_SUCCESS ||
+        mmal_port_format_commit(decoder->output[0]) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't commit changed output format to decoder\n");
+        return false;
+    }
+    if (buffer_num < pool_out->headers_num) {
+        buffer_num = pool_out->headers_num;
+    }
+    if (buffer_size < decoder->output[0]->buffer_size_recommended) {
+        buffer_size = decoder->output[0]->buffer_size_recommended;
+    }
+    if ((buffer_num > pool_out->headers_num || buffer_size > pool_out->header[0]->alloc_size) &&
+        mmal_pool_resize(pool_out, buffer_num, buffer_size) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't resize decoder output pool\n");
+        return false;
+    }
+    decoder->output[0]->buffer_num = buffer_num;
+    decoder->output[0]->buffer_size = buffer_size;
+    if (mmal_format_full_copy(renderer->input[0]->format, format) != MMAL_SUCCESS ||
+        mmal_port_format_commit(renderer->input[0]) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't set output format\n");
+        return false;
+    }
+    if (mmal_port_enable(renderer->input[0], input_callback) != MMAL_SUCCESS ||
+        mmal_port_enable(decoder->output[0], output_callback) != MMAL_SUCCESS) {
+        fprintf(stderr, "Can't enable ports after format change\n");
+        return false;
+    }
+    fill_output();
+    stream_width = format->es->video.crop.width;
+    stream_height = format->es->video.crop.height;
+    printf("mmal output format changed to %u x %u, %u buffers, in %u ms\n", stream_width, stream_height, buffer_num,
+           SDL_GetTicks() - begin);
+    return true;
+}
+
+static void fill_output() {
+    recycle_output = true;
+    MMAL_BUFFER_HEADER_T *buf;
+    while ((buf = mmal_queue_get(pool_out->queue)) != NULL) {
+        if (mmal_port_send_buffer(decoder->output[0], buf) != MMAL_SUCCESS) {
+            mmal_buffer_header_release(buf);
+            break;
+        }
+    }
+}
+
+void mmalvid_prewarm() {
+    pthread_once(&vc_once, vc_init);
+    pthread_mutex_lock(&spare_lock);
+    if (spare_decoder == NULL && mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_DECODER,
+                                                       &spare_decoder) != MMAL_SUCCESS) {
+        spare_decoder = NULL;
+    }
+    if (spare_renderer == NULL && mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER,
+                                                        &spare_renderer) != MMAL_SUCCESS) {
+        spare_renderer = NULL;
+    }
+    pthread_mutex_unlock(&spare_lock);
+}
+
+void mmalvid_deinit() {
+    pthread_mutex_lock(&spare_lock);
+    if (spare_decoder != NULL) {
+        mmal_component_destroy(spare_decoder);
+        spare_decoder = NULL;
+    }
+    if (spare_renderer != NULL) {
+        mmal_component_destroy(spare_renderer);
+        spare_renderer = NULL;
+    }
+    pthread_mutex_unlock(&spare_lock);
+}
+
+static void vc_init() {
+    bcm_host_init();
+    mmal_vc_init();
+    changed_format = mmal_format_alloc();
+    applied_format = mmal_format_alloc();
+}
+
+/**
+ * Take the pre-warmed component if there is one, ports of a fresh component are unconfigured either way
+ */
+static MMAL_STATUS_T component_create(const char *name, MMAL_COMPONENT_T **spare, MMAL_COMPONENT_T **component) {
+    pthread_mutex_lock(&spare_lock);
+    MMAL_COMPONENT_T *adopted = *spare;
+    *spare = NULL;
+    pthread_mutex_unlock(&spare_lock);
+    if (adopted != NULL) {
+        *component = adopted;
+        return MMAL_SUCCESS;
+    }
+    return mmal_component_create(name, component);
+}
+
+static void teardown_decoder() {
+    recycle_output = false;
+    if (decoder) {
+        if (decoder->output[0]->is_enabled) {
+            mmal_port_disable(decoder->output[0]);
+        }
         mmal_component_destroy(decoder);
+        decoder = NULL;
+    }
 
-    if (renderer)
+    if (renderer) {
         mmal_component_destroy(renderer);
+        renderer = NULL;
+    }
 
-    if (pool_in)
+    if (pool_in) {
         mmal_pool_destroy(pool_in);
+        pool_in = NULL;
+    }
 
-    if (pool_out)
+    if (pool_out) {
         mmal_pool_destroy(pool_out);
+        pool_out = NULL;
+    }
+    // An event from the old decoder doesn't describe the next one
+    pthread_mutex_lock(&event_lock);
+    format_changed = false;
+    pthread_mutex_unlock(&event_lock);
+}
 
-    vcos_semaphore_delete(&semaphore);
+static void Stop(IHS_Session *session, void *context) {
+    pthread_mutex_lock(&pipeline_lock);
+    if (!suspended) {
+        teardown_decoder();
+    }
+    print_stats();
+    backpressure_print_stats(&backpressure);
+    param_cache_print_stats(&param_cache);
+    started = false;
+    suspended = false;
+    pthread_mutex_unlock(&pipeline_lock);
 }
 
+void mmalvid_suspend() {
+    pthread_mutex_lock(&pipeline_lock);
+    if (started && !suspended) {
+        teardown_decoder();
+        suspended = true;
+        printf("mmal decoder suspended\n");
+    }
+    pthread_mutex_unlock(&pipeline_lock);
+}
+
+void mmalvid_resume() {
+    pthread_mutex_lock(&pipeline_lock);
+    if (started && suspended) {
+        suspended = false;
+        resume_ticks = SDL_GetTicks();
+        if (setup_decoder(stream_width, stream_height) == 0) {
+            need_keyframe = true;
+            keyframe_requested = false;
+        } else {
+            teardown_decoder();
+            started = false;
+        }
+    }
+    pthread_mutex_unlock(&pipeline_lock);
+}
+
+static int submit_locked(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags);
+
 static int Submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags,
                   void *context) {
+    pthread_mutex_lock(&pipeline_lock);
+    int ret = submit_locked(session, data, flags);
+    pthread_mutex_unlock(&pipeline_lock);
+    return ret;
+}
+
+static int submit_locked(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFlag flags) {
     if (!started) {
-        return DR_NEED_IDR;
+        // Pipeline couldn't be rebuilt, keep asking for a key frame without flooding the host
+        return backpressure_request_idr(&backpressure);
     }
+    if (suspended) {
+        // Nothing to decode into. Key frame will be requested on resume
+        return DR_OK;
+    }
+    bool has_params = param_cache_update(&param_cache, IHS_BufferPointer(data), data->size);
+    if (need_keyframe) {
+        bool keyframe = flags & IHS_StreamVideoFrameKeyFrame;
+        // A frame with recovery point SEI starts a refresh, cached parameter sets are all the decoder needs
+        if (!keyframe && !param_cache_can_resume(&param_cache)) {
+            // Ask only once, the host will send an IDR shortly
+            if (keyframe_requested) {
+                return DR_OK;
+            }
+            keyframe_requested = true;
+            return DR_NEED_IDR;
+        }
+        need_keyframe = false;
+        if (!keyframe) {
+            param_cache.stats.idr_avoided++;
+        }
+        printf("mmal decoder resumed, first %s after %u ms\n", keyframe ? "key frame" : "frame without IDR",
+               SDL_GetTicks() - resume_ticks);
+    }
+    pthread_mutex_lock(&event_lock);
+    bool decoder_changed = format_changed && mmal_format_full_copy(applied_format, changed_format) == MMAL_SUCCESS;
+    uint32_t buffer_num = changed_buffer_num, buffer_size = changed_buffer_size;
+    format_changed = false;
+    pthread_mutex_unlock(&event_lock);
+    // Crop, colour space or buffer requirements may change without a new size, always take the whole format
+    if (decoder_changed && !apply_output_format(applied_format, buffer_num, buffer_size)) {
+        sps_dimension_t event_dimension = {
+                .width = applied_format->es->video.crop.width,
+                .height = applied_format->es->video.crop.height,
+        };
+        ChangedSize(session, &event_dimension);
+        if (!started) {
+            return backpressure_request_idr(&backpressure);
+        }
+    }
+    sps_info_t info;
+    nal_unit_t sps_unit;
+    bool has_sps = false;
     if (flags == IHS_StreamVideoFrameKeyFrame) {
-        sps_dimension_t dimension;
-        if (sps_parse_dimension_h264(IHS_BufferPointerAt(data, 4), &dimension) &&
-            SizeChanged(&decoder->input[0]->format->es->video, &dimension)) {
-            ChangedSize(session, &dimension);
+        // Key frames may start with an AUD or SEI, and use 3 or 4 byte start codes
+        has_sps = annexb_find(IHS_BufferPointer(data), data->size, IHS_StreamVideoCodecH264, NAL_TYPE_H264_SPS,
+                              &sps_unit) &&
+                  sps_parse_h264(IHS_BufferPointerAt(data, sps_unit.offset), sps_unit.size, &info);
+        if (has_sps) {
+            if (!stream_info_valid) {
+                printf("H.264 stream %u x %u, %.2f fps, %u reorder frames, DPB %u frames%s\n", info.dimension.width,
+                       info.dimension.height, info.frame_rate_num ? (double) info.frame_rate_num /
+                                                                    (double) info.frame_rate_den : 0.0,
+                       info.max_num_reorder_frames, info.max_dec_frame_buffering,
+                       info.reorder_signalled ? "" : " (level limit)");
+            }
+            stream_info = info;
+            stream_info_valid = true;
+            if (FormatChanged(&decoder->input[0]->format->es->video, &info)) {
+                ChangedSize(session, &info.dimension);
+            }
         }
     }
+    if (!started) {
+        return backpressure_request_idr(&backpressure);
+    }
+    int ret;
+    // Pool is empty while every input buffer is with the decoder
+    if (!backpressure_admit(&backpressure, data, flags, mmal_queue_length(pool_in->queue) == 0, &ret)) {
+        return ret;
+    }
     MMAL_STATUS_T status;
     MMAL_BUFFER_HEADER_T *buf;
 
-    vcos_semaphore_wait(&semaphore);
-    if ((buf = mmal_queue_get(pool_in->queue)) != NULL) {
-        buf->flags = 0;
-        buf->offset = 0;
-        buf->pts = buf->dts = MMAL_TIME_UNKNOWN;
-    } else {
-        fprintf(stderr, "Video buffer full\n");
-        return DR_NEED_IDR;
+    // Only wait when every input buffer is in flight, and never for long
+    if ((buf = mmal_queue_get(pool_in->queue)) == NULL) {
+        Uint64 wait_begin = SDL_GetPerformanceCounter();
+        buf = mmal_queue_timedwait(pool_in->queue, INPUT_WAIT_MS);
+        uint64_t wait_us = (SDL_GetPerformanceCounter() - wait_begin) * 1000000 / SDL_GetPerformanceFrequency();
+        stats.wait_us += wait_us;
+        if (wait_us > stats.max_wait_us) {
+            stats.max_wait_us = wait_us;
+        }
+        if (wait_us >= STALL_THRESHOLD_US) {
+            stats.stalls++;
+        }
+    }
+    if (buf == NULL) {
+        stats.timeouts++;
+        return backpressure_lost(&backpressure, data);
     }
+    buf->flags = 0;
+    buf->offset = 0;
+    buf->length = 0;
+    buf->pts = buf->dts = MMAL_TIME_UNKNOWN;
 
 //    if (type != IHS_StreamVideoFramePIC)
 //        buf->flags |= MMAL_BUFFER_HEADER_FLAG_CONFIG;
@@ -290,20 +729,52 @@ static int Submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFl
         buf->flags |= MMAL_BUFFER_HEADER_FLAG_KEYFRAME;
     }
 
-    if (data->size + buf->length > buf->alloc_size) {
+    // VideoCore holds pictures back for as many frames as the SPS allows reordering. When the stream doesn't
+    // say it has none, the SPS is patched to say so, and every picture is displayed as soon as it's decoded
+    unsigned char sps[MAX_SPS_SIZE];
+    size_t sps_size = 0;
+    if (has_sps) {
+        sps_size = sps_rewrite_h264_no_reorder(IHS_BufferPointerAt(data, sps_unit.offset), &info, sps, sizeof(sps));
+    }
+    if (sps_size > 0) {
+        // Re-injected SPS must say the same
+        param_cache_store(&param_cache, PARAM_SET_SPS, sps, sps_size);
+    }
+    size_t params_size = inject_params && !has_params ? param_cache_size(&param_cache) : 0;
+    size_t frame_size = sps_size > 0 ? data->size - info.nal_size + sps_size : data->size;
+    if (params_size + frame_size + buf->length > buf->alloc_size) {
         fprintf(stderr, "Video decoder buffer too small\n");
         mmal_buffer_header_release(buf);
-        return DR_NEED_IDR;
+        return backpressure_lost(&backpressure, data);
+    }
+    if (params_size > 0) {
+        buf->length += param_cache_write(&param_cache, buf->data + buf->length, buf->alloc_size - buf->length);
+    }
+    // Only copy of the frame: ihslib owns its reassembly buffer, and buf->data is already visible to VideoCore
+    if (sps_size > 0) {
+        if (!sps_rewritten) {
+            printf("SPS has no bitstream restriction, signalling pictures are output in decoding order\n");
+            sps_rewritten = true;
+        }
+        uint8_t *dst = buf->data + buf->length;
+        size_t sps_end = sps_unit.offset + info.nal_size;
+        IHS_BufferReadMem(data, 0, dst, sps_unit.offset);
+        memcpy(dst + sps_unit.offset, sps, sps_size);
+        IHS_BufferReadMem(data, sps_end, dst + sps_unit.offset + sps_size, data->size - sps_end);
+    } else {
+        IHS_BufferReadMem(data, 0, buf->data + buf->length, data->size);
     }
-    IHS_BufferReadMem(data, 0, buf->data + buf->length, data->size);
-    buf->length += data->size;
+    buf->length += frame_size;
 
     if ((status = mmal_port_send_buffer(decoder->input[0], buf)) != MMAL_SUCCESS) {
         mmal_buffer_header_release(buf);
-        return DR_NEED_IDR;
+        return backpressure_lost(&backpressure, data);
     }
 
-    //Send available output buffers to decoder
+    stats.frames++;
+    inject_params = false;
+
+    // Output buffers are recycled from output_pool_callback, this only picks up ones it failed to send
     while ((buf = mmal_queue_get(pool_out->queue))) {
         if ((status = mmal_port_send_buffer(decoder->output[0], buf)) != MMAL_SUCCESS)
             mmal_buffer_header_release(buf);
@@ -313,16 +784,66 @@ static int Submit(IHS_Session *session, IHS_Buffer *data, IHS_StreamVideoFrameFl
     return DR_OK;
 }
 
+void mmalvid_set_input_depth(uint32_t depth) {
+    if (depth > 0) {
+        input_depth = depth;
+    }
+}
+
+static void print_stats() {
+    if (stats.frames == 0) {
+        return;
+    }
+    double seconds = (double) (SDL_GetPerformanceCounter() - stats.begin) / (double) SDL_GetPerformanceFrequency();
+    printf("mmal decoder stats: %llu frames, %.1f fps, %llu stalls, %llu timeouts, wait avg %.3f ms max %.3f ms\n",
+           (unsigned long long) stats.frames, (double) stats.frames / seconds, (unsigned long long) stats.stalls,
+           (unsigned long long) stats.timeouts, (double) stats.wait_us / 1000.0 / (double) stats.frames,
+           (double) stats.max_wait_us / 1000.0);
+}
+
 static void ChangedSize(IHS_Session *session, const sps_dimension_t *dimension) {
-    Stop(session, NULL);
-    setup_decoder(dimension->width, dimension->height);
+    if (reconfigure_decoder(dimension->width, dimension->height)) {
+        return;
+    }
+    // Fall back to rebuilding the whole pipeline
+    teardown_decoder();
+    if (setup_decoder(dimension->width, dimension->height) != 0) {
+        teardown_decoder();
+        started = false;
+    }
+}
+
+static bool FormatChanged(const MMAL_VIDEO_FORMAT_T *video, const sps_info_t *info) {
+    if (ALIGN(info->dimension.width, 32) != video->width || ALIGN(info->dimension.height, 16) != video->height) {
+        return true;
+    }
+    if (info->frame_rate_num != 0 && ((uint32_t) video->frame_rate.num != info->frame_rate_num ||
+                                      (uint32_t) video->frame_rate.den != info->frame_rate_den)) {
+        return true;
+    }
+    return video->color_space != stream_color_space(info);
 }
 
-static bool SizeChanged(const MMAL_VIDEO_FORMAT_T *video, const sps_dimension_t *dimension) {
-    return ALIGN(dimension->width, 32) != video->width || ALIGN(dimension->height, 16) != video->height;
+static MMAL_FOURCC_T stream_color_space(const sps_info_t *info) {
+    switch (info->matrix_coefficients) {
+        case 1:
+            return MMAL_COLOR_SPACE_ITUR_BT709;
+        case 4:
+            return MMAL_COLOR_SPACE_FCC;
+        case 5:
+        case 6:
+            return info->full_range ? MMAL_COLOR_SPACE_JPEG_JFIF : MMAL_COLOR_SPACE_ITUR_BT601;
+        case 7:
+            return MMAL_COLOR_SPACE_SMPTE240M;
+        default:
+            return MMAL_COLOR_SPACE_UNKNOWN;
+    }
 }
 
 bool mmalvid_set_region(bool fullscreen, int x, int y, int w, int h) {
+    if (renderer == NULL) {
+        return false;
+    }
     MMAL_DISPLAYREGION_T param;
     param.hdr.id = MMAL_PARAMETER_DISPLAYREGION;
     param.hdr.size = sizeof(MMAL_DISPLAYREGION_T);
@@ -347,6 +868,6 @@ const IHS_StreamVideoCallbacks VideoCallbacks = {
         .stop = Stop,
 };
 
-const IHS_StreamVideoCallbacks *module_video_callbacks() {
+const IHS_StreamVideoCallbacks *mmalvid_callbacks() {
     return &VideoCallbacks;
 }
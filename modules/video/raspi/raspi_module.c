@@ -1,10 +1,60 @@
 #include "module.h"
+#include "decoders.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-void module_init(int argc, char *argv[]) {
+static void raspi_init(int argc, char *argv[]) {
+    const char *depth = getenv("IHSPLAY_MMAL_INPUT_BUFFERS");
+    if (depth != NULL) {
+        mmalvid_set_input_depth((uint32_t) atoi(depth));
+    }
+    const char *latency = getenv("IHSPLAY_AUDIO_LATENCY_MS");
+    if (latency != NULL) {
+        alsaaud_set_latency_target(atoi(latency));
+    }
+    const char *low_latency = getenv("IHSPLAY_AUDIO_LOW_LATENCY");
+    if (low_latency != NULL && strcmp(low_latency, "0") != 0) {
+        alsaaud_set_low_latency(true);
+    }
 }
 
-void module_post_init(int argc, char *argv[]) {
+static void raspi_prewarm() {
+    mmalvid_prewarm();
+    alsaaud_prewarm();
+}
+
+static void raspi_deinit() {
+    mmalvid_deinit();
+    alsaaud_deinit();
+}
+
+static void raspi_suspend() {
+    mmalvid_suspend();
+    alsaaud_suspend();
+}
+
+static void raspi_resume() {
+    mmalvid_resume();
+    alsaaud_resume();
+}
 
+static bool raspi_probe() {
+    // VideoCore libraries can be installed on boards without VideoCore
+    return access("/dev/vchiq", R_OK | W_OK) == 0;
 }
+
+IHSPLAY_MODULE_EXPORT const ihsplay_module_t ihsplay_module = {
+        .name = "raspi",
+        .probe = raspi_probe,
+        .init = raspi_init,
+        .prewarm = raspi_prewarm,
+        .deinit = raspi_deinit,
+        .audio = alsaaud_callbacks,
+        .audio_arrival = alsaaud_set_arrival,
+        .video = mmalvid_callbacks,
+        .suspend = raspi_suspend,
+        .resume = raspi_resume,
+        // Video is on a dispmanx layer below the UI
+};